@@ -23,7 +23,9 @@ const char usage[] =
 int main(int argc, char **argv)
 {
     if (argc < 2 || strcmp(argv[1], "--help") == 0) {
-        temaku_markup(NULL, &temaku_stderr_writer, usage, 0);
+        /* Only output the sequences stderr can actually display */
+        temaku_options_t options = temaku_detect_options(2);
+        temaku_markup(&options, &temaku_stderr_writer, usage, 0);
     } else if (strcmp(argv[1], "--export-usage") == 0) {
         temaku_file_writer_t writer = temaku_file_writer_open("usage.txt", "wb");
         temaku_options_t options = TEMAKU_DEFAULT_OPTIONS;
@@ -21,6 +21,21 @@
 /* Forward declaration */
 typedef struct temaku_options temaku_options_t;
 typedef struct temaku_string temaku_string_t;
+typedef struct temaku_count_writer temaku_count_writer_t;
+typedef struct temaku_buffer_writer temaku_buffer_writer_t;
+typedef struct temaku_stream temaku_stream_t;
+typedef struct temaku_cell temaku_cell_t;
+typedef struct temaku_line temaku_line_t;
+typedef struct temaku_frame temaku_frame_t;
+typedef struct temaku_screen temaku_screen_t;
+typedef struct temaku_target temaku_target_t;
+typedef struct temaku_fanout temaku_fanout_t;
+typedef struct temaku_param temaku_param_t;
+typedef struct temaku_params temaku_params_t;
+typedef struct temaku_template_op temaku_template_op_t;
+typedef struct temaku_template temaku_template_t;
+typedef struct temaku_render temaku_render_t;
+typedef struct temaku_ansi_decoder temaku_ansi_decoder_t;
 
 /**
  * A string with precalculated length.
@@ -38,8 +53,10 @@ struct temaku_string {
  *
  * @{TEMAKU_START}                  Start a piece of marked-up temaku text.
  *                                  Argument is a :type:`temaku_string_t` containing the text to be marked up.
+ *                                  The string is empty when using :func:`temaku_stream_begin`.
  * @{TEMAKU_END}                    End a piece of marked-up temaku text.
  *                                  Argument is a :type:`temaku_string_t` containing the text that has been marked up.
+ *                                  The string is empty when using :func:`temaku_stream_end`.
  * @{TEMAKU_DATA}                   Write a raw piece of text.
  *                                  Certain character sequences may be escaped here.
  *                                  Argument is a :type:`temaku_string_t` containing the data to write.
@@ -137,6 +154,10 @@ typedef int (*TEMAKU_SELF)(void);
  *              See :type:`TEMAKU_SELF` for details.
  * @{data}      The pointer to the data to write.
  * @{size}      The size of the data to write.
+ *
+ * Returns the number of bytes written, or a negative value on errors.
+ * Writers used with :type:`temaku_render_t` may write less than @{size}
+ * bytes (including none at all) when writing more would block.
  */
 typedef int (*temaku_writer_t)(TEMAKU_SELF *self, const void *data, size_t size);
 /**
@@ -152,6 +173,19 @@ typedef int (*temaku_writer_t)(TEMAKU_SELF *self, const void *data, size_t size)
  *              See `:type:enum temaku_sequence` for details.
  */
 typedef int (*temaku_sequence_writer_t)(TEMAKU_SELF *self, temaku_options_t *options, temaku_writer_t *writer, enum temaku_sequence seq, void *arg);
+/**
+ * Callback to write the value of a ``%P{name}`` parameter with.
+ * The value should be written with :func:`temaku_writedata` or :func:`temaku_writedataint`,
+ * so that it is escaped properly for the sequence writer in @{options}.
+ *
+ * @{self}      The pointer to the function pointer currently being called.
+ *              See :type:`TEMAKU_SELF` for details.
+ * @{options}   Options to use for the current invocation.
+ * @{writer}    Writer to write the value to.
+ * @{name}      The name of the parameter, not NUL-terminated.
+ * @{size}      The length of @{name}.
+ */
+typedef int (*temaku_param_resolver_t)(TEMAKU_SELF *self, temaku_options_t *options, temaku_writer_t *writer, const char *name, size_t size);
 
 /**
  * Write @{size} bytes from @{data} to writer @{self}.
@@ -175,9 +209,54 @@ TEMAKU_API(int) temaku_writeint(temaku_writer_t *self, int val);
 TEMAKU_API(int) temaku_writehex(temaku_writer_t *self, int val);
 /**
  * Write the @{size} bytes in @{url} to writer @{self}.
- * The written string will be URI-escaped.
+ * The written string will be URI-escaped, every byte outside of printable
+ * ASCII (including each byte of a UTF-8 character) becomes ``%XX``.
  */
 TEMAKU_API(int) temaku_writeurl(temaku_writer_t *self, const char *url, size_t size);
+/**
+ * Return the length of the longest prefix of the @{size} bytes in @{data}
+ * that is valid UTF-8 and doesn't end in the middle of a character.
+ * The whole input is valid if this returns @{size}.
+ * Writers pass invalid bytes through unchanged, so use this to check
+ * text (e.g. for an HTML page) before writing it.
+ */
+TEMAKU_API(size_t) temaku_utf8_valid(const char *data, size_t size);
+
+/**
+ * Writer that discards its data and only counts the number of bytes written.
+ *
+ * @{writer}    The writer callback. Pass ``&w.writer`` wherever a :type:`temaku_writer_t` is expected.
+ * @{count}     The number of bytes written so far.
+ */
+struct temaku_count_writer {
+    temaku_writer_t writer;
+    size_t count;
+};
+/**
+ * Writer that writes into a fixed-size memory buffer.
+ * Bytes that do not fit in the buffer are discarded, but still counted.
+ *
+ * @{writer}    The writer callback. Pass ``&w.writer`` wherever a :type:`temaku_writer_t` is expected.
+ * @{base}      Pointer to the start of the buffer.
+ * @{capacity}  The size of the buffer in bytes.
+ * @{size}      The number of bytes written so far.
+ *              May be larger than @{capacity}, in which case the output was truncated.
+ */
+struct temaku_buffer_writer {
+    temaku_writer_t writer;
+    char *base;
+    size_t capacity;
+    size_t size;
+};
+
+/**
+ * Create a new :type:`temaku_count_writer_t` with a count of zero.
+ */
+TEMAKU_API(temaku_count_writer_t) temaku_count_writer_new(void);
+/**
+ * Create a new :type:`temaku_buffer_writer_t` writing to the @{cap} bytes in @{buf}.
+ */
+TEMAKU_API(temaku_buffer_writer_t) temaku_buffer_writer_new(char *buf, size_t cap);
 
 /**
  * Options for changing the behaviour of temaku.
@@ -186,6 +265,8 @@ TEMAKU_API(int) temaku_writeurl(temaku_writer_t *self, const char *url, size_t s
  * @{wordchars}          Characters that make valid "words".
  *                       The behaviour of certain markup characters (e.g. ``_``)
  *                       does not apply in the middle of a "word".
+ *                       May contain UTF-8 characters (e.g. ``TEMAKU_DEFAULT_WORDCHARS "äöüß"``),
+ *                       which only match the same character as a whole.
  * @{string_terminator}  The character to terminate strings with.
  *                       ANSI specifies a "string terminator" sequence which
  *                       is defined in ``TEMAKU_ST``, however, many terminals
@@ -206,6 +287,323 @@ struct temaku_options {
     bool do_links;
 };
 
+/**
+ * State of a piece of temaku markup that is processed in multiple chunks.
+ * The fields are private and should only be used by temaku itself.
+ *
+ * @{options}    The options passed to :func:`temaku_stream_begin`.
+ * @{writer}     The writer passed to :func:`temaku_stream_begin`.
+ * @{row}        The current line number.
+ * @{column}     The current column, in bytes.
+ * @{fgcolor}    The current foreground color, or ``-1`` for no color.
+ * @{bgcolor}    The current background color, or ``-1`` for no color.
+ * @{ctx}        Bitmask of the styles that are active until the end of the line.
+ * @{in_word}    Whether the last character written was a word character.
+ * @{in_raw}     Whether we are inside of a ``%{ ... %}`` block.
+ * @{raw_last}   The last character read inside of a ``%{ ... %}`` block.
+ *               Or ``'}'`` when a block was closed right at the end of the last chunk.
+ * @{wordchars}  The word characters that @{wordset} was built from, or ``NULL`` before it is needed.
+ * @{wordset}    Bitmap of the ASCII characters in @{wordchars}.
+ * @{resolver}   Callback for ``%P{name}`` parameters, or ``NULL`` to leave them out.
+ *               This field is public, and may be set after :func:`temaku_stream_begin`.
+ */
+struct temaku_stream {
+    temaku_options_t *options;
+    temaku_writer_t *writer;
+    int row, column;
+    int fgcolor, bgcolor;
+    unsigned ctx;
+    bool in_word;
+    bool in_raw;
+    char raw_last;
+    const char *wordchars;
+    unsigned char wordset[16];
+    temaku_param_resolver_t *resolver;
+};
+
+/**
+ * A single character cell of a :type:`temaku_screen_t`.
+ *
+ * @{ch}     The UTF-8 encoded character, padded with NUL bytes.
+ * @{size}   The number of bytes in @{ch}.
+ * @{attr}   Bitmask of the active text styles.
+ * @{fg}     The foreground color, or ``-1`` for no color.
+ * @{bg}     The background color, or ``-1`` for no color.
+ */
+struct temaku_cell {
+    char ch[4];
+    unsigned char size;
+    unsigned char attr;
+    signed char fg, bg;
+};
+/**
+ * A single line of a :type:`temaku_frame_t`.
+ *
+ * @{start}  Index of the first cell of the line.
+ * @{size}   The number of cells in the line.
+ * @{fill}   The background color to fill the rest of the line with (see ``%E``),
+ *           ``-1`` for no color, ``-2`` if the line is not filled or ``-3`` if unknown.
+ */
+struct temaku_line {
+    size_t start;
+    size_t size;
+    int fill;
+};
+/**
+ * The rendered cells of a :type:`temaku_screen_t`.
+ *
+ * @{cells}  The cells of all lines, one after the other.
+ * @{lines}  The lines of the frame.
+ * @{raw}    The contents of the ``%{ ... %}`` blocks, which take up no cells.
+ */
+struct temaku_frame {
+    temaku_cell_t *cells;
+    size_t ncells, cells_capacity;
+    temaku_line_t *lines;
+    size_t nlines, lines_capacity;
+    char *raw;
+    size_t nraw, raw_capacity;
+};
+/**
+ * Retained-mode state for a region of the terminal that is redrawn often.
+ * Each update is diffed against the previous one, and only the cells that
+ * changed are written, together with the cursor movement to reach them.
+ * The fields are private and should only be used by temaku itself.
+ *
+ * @{sequence_writer}  Sequence writer that renders into @{frames} instead of writing.
+ * @{capture}          Writer that collects the ``%{ ... %}`` blocks, which bypass @{sequence_writer}.
+ * @{frames}           The previous and the current frame.
+ * @{current}          Index of the frame currently on the screen.
+ * @{drawn}            Whether a frame has been drawn yet.
+ * @{failed}           Whether memory allocation failed while rendering.
+ * @{pen}              The attributes of the next cell to render.
+ */
+struct temaku_screen {
+    temaku_sequence_writer_t sequence_writer;
+    struct temaku_screen_capture {
+        temaku_writer_t writer;
+        temaku_screen_t *screen;
+    } capture;
+    temaku_frame_t frames[2];
+    int current;
+    bool drawn;
+    bool failed;
+    temaku_cell_t pen;
+};
+
+/**
+ * One of the outputs of a :type:`temaku_fanout_t`.
+ *
+ * @{options}    The options to render this output with.
+ *               If set to ``NULL``, :var:`temaku_default_options` is used instead.
+ * @{writer}     The writer to write this output to.
+ */
+struct temaku_target {
+    temaku_options_t *options;
+    temaku_writer_t *writer;
+};
+/**
+ * Parses markup once and renders it to multiple targets.
+ * Pass @{options} and ``&writer.writer`` to :func:`temaku_markup` or
+ * :func:`temaku_stream_begin` to use it.
+ * Since @{options} points into the struct itself, it must not be moved after
+ * :func:`temaku_fanout_init`.
+ *
+ * @{sequence_writer}  Sequence writer that passes every sequence on to the targets that want it.
+ * @{writer}           Writer that passes raw output on to every target.
+ * @{options}          The options to parse with.
+ *                     Uses the word characters of the first target, with all markup enabled.
+ * @{targets}          The targets to render to.
+ * @{ntargets}         The number of targets.
+ */
+struct temaku_fanout {
+    temaku_sequence_writer_t sequence_writer;
+    struct temaku_fanout_writer {
+        temaku_writer_t writer;
+        temaku_fanout_t *fanout;
+    } writer;
+    temaku_options_t options;
+    temaku_target_t *targets;
+    size_t ntargets;
+};
+
+/**
+ * The value of a ``%P{name}`` parameter.
+ *
+ * @{name}       The name of the parameter, or ``NULL`` if it can only be used by position (e.g. ``%P{1}``).
+ * @{str}        The string value, or ``NULL`` to use @{integer} instead.
+ * @{size}       The length of @{str}. If set to ``0``, @{str} is NUL-terminated.
+ * @{integer}    The integer value, written in decimal.
+ */
+struct temaku_param {
+    const char *name;
+    const char *str;
+    size_t size;
+    long long integer;
+};
+/**
+ * Parameter resolver that looks parameters up in an array.
+ * ``%P{1}`` refers to the first parameter, ``%P{name}`` to the parameter named ``name``.
+ *
+ * @{resolver}   The resolver callback. Pass ``&p.resolver`` wherever a :type:`temaku_param_resolver_t` is expected.
+ * @{params}     The parameters.
+ * @{nparams}    The number of parameters.
+ */
+struct temaku_params {
+    temaku_param_resolver_t resolver;
+    const temaku_param_t *params;
+    size_t nparams;
+};
+/**
+ * :type:`temaku_param_t` initializer for a string parameter.
+ */
+#define TEMAKU_PARAM_STR(name, str) { name, str, 0, 0 }
+/**
+ * :type:`temaku_param_t` initializer for an integer parameter.
+ */
+#define TEMAKU_PARAM_INT(name, integer) { name, NULL, 0, integer }
+
+/**
+ * A single recorded operation of a :type:`temaku_template_t`.
+ *
+ * @{kind}       What to do, either write a sequence, write raw data or resolve a parameter.
+ * @{seq}        The sequence to write.
+ * @{value}      The integer argument of the sequence.
+ * @{offset}     Offset of the string argument, raw data or parameter name in the template strings.
+ * @{size}       Length of the string argument, raw data or parameter name.
+ */
+struct temaku_template_op {
+    enum {
+        TEMAKU_OP_SEQUENCE,
+        TEMAKU_OP_SEQUENCE_INT,
+        TEMAKU_OP_SEQUENCE_STRING,
+        TEMAKU_OP_RAW,
+        TEMAKU_OP_PARAM,
+    } kind;
+    enum temaku_sequence seq;
+    int value;
+    size_t offset;
+    size_t size;
+};
+/**
+ * Markup that has been parsed once, and can be rendered many times with
+ * different options, sequence writers and parameters.
+ * The fields are private and should only be used by temaku itself.
+ *
+ * @{sequence_writer}  Sequence writer that records the sequences while compiling.
+ * @{writer}           Writer that records raw data while compiling.
+ * @{resolver}         Parameter resolver that records the parameters while compiling.
+ * @{ops}              The recorded operations.
+ * @{strings}          The text of all string arguments, raw data and parameter names.
+ * @{failed}           Whether memory allocation failed while compiling.
+ */
+struct temaku_template {
+    temaku_sequence_writer_t sequence_writer;
+    struct temaku_template_recorder {
+        temaku_writer_t writer;
+        temaku_template_t *tmpl;
+    } writer;
+    struct temaku_template_resolver {
+        temaku_param_resolver_t resolver;
+        temaku_template_t *tmpl;
+    } resolver;
+    temaku_template_op_t *ops;
+    size_t nops, ops_capacity;
+    char *strings;
+    size_t nstrings, strings_capacity;
+    bool failed;
+};
+
+/**
+ * Result of :func:`temaku_render_resume`.
+ *
+ * @{TEMAKU_RENDER_DONE}        Everything has been written.
+ * @{TEMAKU_RENDER_WOULDBLOCK}  The writer can't accept more data right now.
+ *                              Call :func:`temaku_render_resume` again once it can.
+ * @{TEMAKU_RENDER_ERROR}       The writer returned an error, or memory allocation failed.
+ */
+enum temaku_render_status {
+    TEMAKU_RENDER_DONE,
+    TEMAKU_RENDER_WOULDBLOCK,
+    TEMAKU_RENDER_ERROR,
+};
+/**
+ * The default number of bytes of markup :type:`temaku_render_t` processes at once.
+ */
+#define TEMAKU_RENDER_CHUNK_SIZE 4096
+/**
+ * A render of temaku markup to a non-blocking writer, that can be suspended
+ * whenever the writer would block and resumed later.
+ * The markup is processed a few kilobytes at a time, so only the output of those
+ * bytes is kept in memory while waiting for the writer.
+ * The fields are private and should only be used by temaku itself, except
+ * for ``stream.resolver`` and @{chunk_size}, which may be set after :func:`temaku_render_init`.
+ *
+ * @{stream}      The parser state.
+ * @{capture}     Writer that appends the parser output to @{buffer}.
+ * @{writer}      The non-blocking writer to write to.
+ * @{markup}      The markup to render.
+ * @{markuplen}   The length of @{markup}.
+ * @{pos}         How many bytes of @{markup} have been processed.
+ * @{buffer}      Output that has not been written yet.
+ * @{size}        The number of bytes in @{buffer}.
+ * @{capacity}    The size of @{buffer} in bytes.
+ * @{sent}        The number of bytes in @{buffer} that have already been written.
+ * @{started}     Whether :type:`TEMAKU_START` has been processed.
+ * @{finished}    Whether :type:`TEMAKU_END` has been processed.
+ * @{failed}      Whether memory allocation failed.
+ * @{chunk_size}  About how many bytes of markup to process at once,
+ *                ``TEMAKU_RENDER_CHUNK_SIZE`` unless changed.
+ */
+struct temaku_render {
+    temaku_stream_t stream;
+    struct temaku_render_capture {
+        temaku_writer_t writer;
+        temaku_render_t *render;
+    } capture;
+    temaku_writer_t *writer;
+    const char *markup;
+    size_t markuplen;
+    size_t pos;
+    char *buffer;
+    size_t size, capacity, sent;
+    bool started;
+    bool finished;
+    bool failed;
+    size_t chunk_size;
+};
+
+/**
+ * The longest escape sequence :type:`temaku_ansi_decoder_t` understands, in bytes.
+ * Longer sequences (e.g. hyperlinks with very long URLs) are dropped.
+ */
+#define TEMAKU_ANSI_MAX_SEQUENCE 2048
+/**
+ * State of ANSI escape sequence input that is being turned back into temaku
+ * sequences, so it can be written with any sequence writer (e.g. as HTML).
+ * The fields are private and should only be used by temaku itself.
+ *
+ * @{options}    The options to write the sequences with.
+ * @{writer}     The writer to write the result to.
+ * @{state}      Where in an escape sequence the last chunk ended.
+ * @{attr}       Bitmask of the active text styles.
+ * @{fgcolor}    The current foreground color, or ``-1`` for no color.
+ * @{bgcolor}    The current background color, or ``-1`` for no color.
+ * @{in_link}    Whether a hyperlink is open.
+ * @{size}       The number of bytes in @{buffer}.
+ * @{buffer}     The parameters of the escape sequence that is being read.
+ */
+struct temaku_ansi_decoder {
+    temaku_options_t *options;
+    temaku_writer_t *writer;
+    int state;
+    unsigned attr;
+    int fgcolor, bgcolor;
+    bool in_link;
+    size_t size;
+    char buffer[TEMAKU_ANSI_MAX_SEQUENCE];
+};
+
 /**
  * BEL string terminator.
  */
@@ -250,6 +648,7 @@ TEMAKU_API(temaku_sequence_writer_t) temaku_write_html_sequence;
 TEMAKU_API(int) temaku_writesequence(temaku_options_t *options, temaku_writer_t *writer, enum temaku_sequence seq, void *arg);
 /**
  * Write the marked-up result of the @{markuplen} bytes in @{markup} to writer @{writer}, using the options specified in @{options}.
+ * Returns the sum of the values returned by the writer (usually the number of bytes written).
  *
  * @{options}       The options to use when writing markup sequences.
  *                  If set to ``NULL``, :var:`temaku_default_options` is used instead.
@@ -259,5 +658,225 @@ TEMAKU_API(int) temaku_writesequence(temaku_options_t *options, temaku_writer_t
  *                  If set to ``SIZE_MAX`` or ``0``, processes up to the first NUL character.
  */
 TEMAKU_API(int) temaku_markup(temaku_options_t *options, temaku_writer_t *writer, const char *markup, size_t markuplen);
+/**
+ * Start processing a piece of temaku markup in multiple chunks.
+ * Feed the chunks with :func:`temaku_stream_write` and finish with :func:`temaku_stream_end`.
+ *
+ * @{stream}        The stream state to initialize.
+ * @{options}       The options to use when writing markup sequences.
+ *                  If set to ``NULL``, :var:`temaku_default_options` is used instead.
+ * @{writer}        The writer to write the marked-up result to.
+ */
+TEMAKU_API(int) temaku_stream_begin(temaku_stream_t *stream, temaku_options_t *options, temaku_writer_t *writer);
+/**
+ * Write the marked-up result of the next @{markuplen} bytes of markup in @{markup}.
+ * Sequences like ``%F{red}`` must not be split between chunks, splitting
+ * chunks after a newline is safe as long as no ``{...}`` argument spans
+ * multiple lines. ``%{ ... %}`` blocks may span chunks.
+ *
+ * @{stream}        The stream started with :func:`temaku_stream_begin`.
+ * @{markup}        The next chunk of temaku markup to process.
+ * @{markuplen}     The length of the chunk, processing stops early at a NUL character.
+ */
+TEMAKU_API(int) temaku_stream_write(temaku_stream_t *stream, const char *markup, size_t markuplen);
+/**
+ * Write the @{size} bytes in @{data} as plain text, in the middle of @{stream},
+ * without treating them as markup. This is how to write bytes that
+ * :func:`temaku_stream_write` can't take, like NUL characters.
+ * Afterwards, the stream is not in the middle of a word or at the start of a line.
+ */
+TEMAKU_API(int) temaku_stream_writedata(temaku_stream_t *stream, const char *data, size_t size);
+/**
+ * Close all styles that are still active and finish processing @{stream}.
+ */
+TEMAKU_API(int) temaku_stream_end(temaku_stream_t *stream);
+/**
+ * Calculate the exact number of bytes :func:`temaku_markup` would write for the @{markuplen} bytes in @{markup}, without writing anything.
+ *
+ * @{options}       The options to use when writing markup sequences.
+ *                  If set to ``NULL``, :var:`temaku_default_options` is used instead.
+ * @{markup}        The temaku markup string to process.
+ * @{markuplen}     The length of the markup string.
+ *                  If set to ``SIZE_MAX`` or ``0``, processes up to the first NUL character.
+ */
+TEMAKU_API(size_t) temaku_measure(temaku_options_t *options, const char *markup, size_t markuplen);
+/**
+ * Write the marked-up result of the @{markuplen} bytes in @{markup} to the @{cap} bytes in @{buf}.
+ * Like ``snprintf``, the output is truncated to fit and always NUL-terminated if @{cap} is not ``0``.
+ *
+ * Returns the number of bytes the full output takes, not including the NUL terminator.
+ * If the result is ``cap`` or larger, the output was truncated.
+ *
+ * @{options}       The options to use when writing markup sequences.
+ *                  If set to ``NULL``, :var:`temaku_default_options` is used instead.
+ * @{buf}           The buffer to write the marked-up result to.
+ * @{cap}           The size of @{buf} in bytes.
+ * @{markup}        The temaku markup string to process.
+ * @{markuplen}     The length of the markup string.
+ *                  If set to ``SIZE_MAX`` or ``0``, processes up to the first NUL character.
+ */
+TEMAKU_API(size_t) temaku_markup_to_buffer(temaku_options_t *options, char *buf, size_t cap, const char *markup, size_t markuplen);
+/**
+ * Initialize the retained-mode state in @{screen}.
+ * The region starts at the beginning of the line the cursor is on during the first update.
+ */
+TEMAKU_API(void) temaku_screen_init(temaku_screen_t *screen);
+/**
+ * Free all memory used by @{screen}.
+ */
+TEMAKU_API(void) temaku_screen_free(temaku_screen_t *screen);
+/**
+ * Forget what is on the screen, so that the next update redraws the region completely.
+ * Use this after something else has written over the region.
+ */
+TEMAKU_API(void) temaku_screen_invalidate(temaku_screen_t *screen);
+/**
+ * Render the @{markuplen} bytes in @{markup} into the region of @{screen},
+ * writing only the ANSI escape sequences and text needed to turn the previous
+ * update into this one.
+ * Afterwards, the cursor is left at the start of the last line of the region,
+ * so the markup should usually end with a newline.
+ *
+ * Every character takes up a single column, and links are not rendered.
+ * The contents of ``%{ ... %}`` blocks take up no columns, they are written
+ * before the changes whenever they differ from the previous update.
+ * Returns ``-1`` if memory allocation failed.
+ *
+ * @{screen}        The retained-mode state, see :func:`temaku_screen_init`.
+ * @{options}       The options to use when writing markup sequences.
+ *                  If set to ``NULL``, :var:`temaku_default_options` is used instead.
+ *                  The sequence writer is ignored, output is always ANSI.
+ * @{writer}        The writer to write the changes to.
+ * @{markup}        The temaku markup string to process.
+ * @{markuplen}     The length of the markup string.
+ *                  If set to ``SIZE_MAX`` or ``0``, processes up to the first NUL character.
+ */
+TEMAKU_API(int) temaku_screen_update(temaku_screen_t *screen, temaku_options_t *options, temaku_writer_t *writer, const char *markup, size_t markuplen);
+/**
+ * Initialize @{fanout} to render to the @{ntargets} targets in @{targets}.
+ * Each target only receives the sequences its own ``do_markup``,
+ * ``do_color``, ``do_style`` and ``do_links`` options allow.
+ */
+TEMAKU_API(void) temaku_fanout_init(temaku_fanout_t *fanout, temaku_target_t *targets, size_t ntargets);
+/**
+ * Write the marked-up result of the @{markuplen} bytes in @{markup} to each of the @{ntargets} targets in @{targets},
+ * parsing the markup only once.
+ * Returns the sum of the values returned by the writers.
+ *
+ * @{targets}       The targets to render to, see :type:`temaku_target_t`.
+ * @{ntargets}      The number of targets.
+ * @{markup}        The temaku markup string to process.
+ * @{markuplen}     The length of the markup string.
+ *                  If set to ``SIZE_MAX`` or ``0``, processes up to the first NUL character.
+ */
+TEMAKU_API(int) temaku_markup_fanout(temaku_target_t *targets, size_t ntargets, const char *markup, size_t markuplen);
+/**
+ * Write the @{size} bytes in @{data} as text, escaped for the sequence writer in @{options}.
+ * If @{size} is ``0``, @{data} is NUL-terminated.
+ */
+TEMAKU_API(int) temaku_writedata(temaku_options_t *options, temaku_writer_t *writer, const char *data, size_t size);
+/**
+ * Write the integer @{val} in decimal as text, escaped for the sequence writer in @{options}.
+ */
+TEMAKU_API(int) temaku_writedataint(temaku_options_t *options, temaku_writer_t *writer, long long val);
+/**
+ * Create a :type:`temaku_params_t` resolving parameters from the @{nparams} parameters in @{params}.
+ */
+TEMAKU_API(temaku_params_t) temaku_params_new(const temaku_param_t *params, size_t nparams);
+/**
+ * Like :func:`temaku_markup`, but resolve ``%P{name}`` parameters with @{resolver}.
+ *
+ * @{resolver}      The parameter resolver, e.g. the ``resolver`` field of a :type:`temaku_params_t`.
+ */
+TEMAKU_API(int) temaku_markup_params(temaku_options_t *options, temaku_writer_t *writer, const char *markup, size_t markuplen, temaku_param_resolver_t *resolver);
+/**
+ * Parse the @{markuplen} bytes in @{markup} into @{tmpl}, so they can be rendered with :func:`temaku_template_render`.
+ * The template can be rendered with any options, except for the word characters, which are taken from @{options}.
+ * Returns ``-1`` if memory allocation failed, or ``0`` otherwise.
+ *
+ * @{tmpl}          The template to initialize, free it with :func:`temaku_template_free`.
+ * @{options}       The options to take the word characters from.
+ *                  If set to ``NULL``, :var:`temaku_default_options` is used instead.
+ * @{markup}        The temaku markup string to process.
+ * @{markuplen}     The length of the markup string.
+ *                  If set to ``SIZE_MAX`` or ``0``, processes up to the first NUL character.
+ */
+TEMAKU_API(int) temaku_template_compile(temaku_template_t *tmpl, temaku_options_t *options, const char *markup, size_t markuplen);
+/**
+ * Write the marked-up result of @{tmpl} to writer @{writer}, without parsing the markup again.
+ * The output is the same as :func:`temaku_markup_params` would write for the original markup.
+ *
+ * @{tmpl}          The template compiled with :func:`temaku_template_compile`.
+ * @{options}       The options to use when writing markup sequences.
+ *                  If set to ``NULL``, :var:`temaku_default_options` is used instead.
+ * @{writer}        The writer to write the marked-up result to.
+ * @{resolver}      The parameter resolver, or ``NULL`` to leave parameters out.
+ */
+TEMAKU_API(int) temaku_template_render(temaku_template_t *tmpl, temaku_options_t *options, temaku_writer_t *writer, temaku_param_resolver_t *resolver);
+/**
+ * Free all memory used by @{tmpl}.
+ */
+TEMAKU_API(void) temaku_template_free(temaku_template_t *tmpl);
+/**
+ * Prepare to render the @{markuplen} bytes in @{markup} to the non-blocking writer @{writer}.
+ * Nothing is written until :func:`temaku_render_resume` is called.
+ * The markup must stay valid until the render is done.
+ *
+ * @{render}        The render to initialize, free it with :func:`temaku_render_free`.
+ * @{options}       The options to use when writing markup sequences.
+ *                  If set to ``NULL``, :var:`temaku_default_options` is used instead.
+ * @{writer}        The writer to write the marked-up result to.
+ *                  It may write less than requested if writing more would block.
+ * @{markup}        The temaku markup string to process.
+ * @{markuplen}     The length of the markup string.
+ *                  If set to ``SIZE_MAX`` or ``0``, processes up to the first NUL character.
+ */
+TEMAKU_API(void) temaku_render_init(temaku_render_t *render, temaku_options_t *options, temaku_writer_t *writer, const char *markup, size_t markuplen);
+/**
+ * Continue rendering @{render} until it is done or its writer would block.
+ * Returns a :type:`enum temaku_render_status`.
+ */
+TEMAKU_API(enum temaku_render_status) temaku_render_resume(temaku_render_t *render);
+/**
+ * Free all memory used by @{render}.
+ */
+TEMAKU_API(void) temaku_render_free(temaku_render_t *render);
+/**
+ * Start turning ANSI escape sequences back into temaku sequences.
+ * SGR sequences (``ESC [ ... m``) become style and color sequences, with
+ * 256 and 24-bit colors mapped to the nearest of the 16 temaku colors, and
+ * OSC 8 hyperlinks become link sequences. Other escape sequences are dropped,
+ * everything else is written as text.
+ * Feed the chunks with :func:`temaku_ansi_write` and finish with :func:`temaku_ansi_end`.
+ *
+ * @{decoder}       The decoder state to initialize.
+ * @{options}       The options to use when writing sequences.
+ *                  If set to ``NULL``, :var:`temaku_default_options` is used instead.
+ * @{writer}        The writer to write the result to.
+ */
+TEMAKU_API(int) temaku_ansi_begin(temaku_ansi_decoder_t *decoder, temaku_options_t *options, temaku_writer_t *writer);
+/**
+ * Decode the next @{size} bytes of ANSI input in @{data}.
+ * Chunks may be split anywhere, including in the middle of an escape sequence.
+ */
+TEMAKU_API(int) temaku_ansi_write(temaku_ansi_decoder_t *decoder, const char *data, size_t size);
+/**
+ * Close all styles, colors and links that are still active and finish decoding.
+ * An unfinished escape sequence at the end of the input is dropped.
+ */
+TEMAKU_API(int) temaku_ansi_end(temaku_ansi_decoder_t *decoder);
+/**
+ * Write the @{size} bytes of ANSI input in @{data} with the sequence writer in @{options},
+ * e.g. to convert colored terminal output to HTML.
+ * Returns the sum of the values returned by the writer.
+ *
+ * @{options}       The options to use when writing sequences.
+ *                  If set to ``NULL``, :var:`temaku_default_options` is used instead.
+ * @{writer}        The writer to write the result to.
+ * @{data}          The ANSI input.
+ * @{size}          The length of the input.
+ *                  If set to ``SIZE_MAX`` or ``0``, processes up to the first NUL character.
+ */
+TEMAKU_API(int) temaku_ansi_decode(temaku_options_t *options, temaku_writer_t *writer, const char *data, size_t size);
 
 #endif /* TEMAKU_H */
@@ -2,8 +2,23 @@
 #define TEMAKU_LIBC_H
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+
+#if defined(_WIN32)
+#include <io.h>
+#define temaku_isatty _isatty
+#else
+#include <errno.h>
+#include <unistd.h>
+#define temaku_isatty isatty
+#endif
 
 typedef struct temaku_file_writer temaku_file_writer_t;
+typedef struct temaku_memory_writer temaku_memory_writer_t;
+typedef struct temaku_terminal temaku_terminal_t;
+typedef struct temaku_fd_writer temaku_fd_writer_t;
 
 struct temaku_file_writer {
     temaku_writer_t writer;
@@ -39,4 +54,335 @@ static temaku_file_writer_t temaku_file_writer_open(const char *path, const char
     return temaku_file_writer_new(fopen(path, mode));
 }
 
+struct temaku_memory_writer {
+    temaku_writer_t writer;
+    char *base;
+    size_t size;
+    size_t capacity;
+};
+
+/* Make room for @{size} bytes plus a NUL terminator, growing geometrically */
+static bool temaku_memory_writer_reserve(temaku_memory_writer_t *writer, size_t size)
+{
+    size_t capacity = writer->capacity ? writer->capacity : 64;
+    char *base;
+    if (size < writer->capacity) return true;
+    while (capacity <= size) capacity *= 2;
+    base = (char *)realloc(writer->base, capacity);
+    if (!base) return false;
+    writer->base = base;
+    writer->capacity = capacity;
+    return true;
+}
+static int temaku_memory_writer_cb(TEMAKU_SELF *self, const void *data, size_t size)
+{
+    temaku_memory_writer_t *writer = (temaku_memory_writer_t *)self;
+    if (size == 0) return 0;
+    if (!temaku_memory_writer_reserve(writer, writer->size + size)) return -1;
+    memcpy(writer->base + writer->size, data, size);
+    writer->size += size;
+    return size;
+}
+
+static temaku_memory_writer_t temaku_memory_writer_new(void)
+{
+    temaku_memory_writer_t writer;
+    writer.writer = temaku_memory_writer_cb;
+    writer.base = NULL;
+    writer.size = 0;
+    writer.capacity = 0;
+    return writer;
+}
+/* Take ownership of the NUL-terminated buffer (free it with ``free``) and reset the writer */
+static char *temaku_memory_writer_release(temaku_memory_writer_t *writer, size_t *size)
+{
+    char *base;
+    if (!temaku_memory_writer_reserve(writer, writer->size)) return NULL;
+    base = writer->base;
+    base[writer->size] = '\0';
+    if (size) *size = writer->size;
+    *writer = temaku_memory_writer_new();
+    return base;
+}
+static void temaku_memory_writer_free(temaku_memory_writer_t *writer)
+{
+    free(writer->base);
+    *writer = temaku_memory_writer_new();
+}
+
+#if !defined(_WIN32)
+struct temaku_fd_writer {
+    temaku_writer_t writer;
+    int fd;
+};
+
+/* Writes what it can without blocking if @{fd} is non-blocking, for use with temaku_render_t */
+static int temaku_fd_writer_cb(TEMAKU_SELF *self, const void *data, size_t size)
+{
+    temaku_fd_writer_t *writer = (temaku_fd_writer_t *)self;
+    ssize_t n;
+    if (size > INT_MAX) size = INT_MAX;
+    do n = write(writer->fd, data, size);
+    while (n < 0 && errno == EINTR);
+    if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+    return n;
+}
+
+static temaku_fd_writer_t temaku_fd_writer_new(int fd)
+{
+    temaku_fd_writer_t writer;
+    writer.writer = temaku_fd_writer_cb;
+    writer.fd = fd;
+    return writer;
+}
+#endif
+
+/*
+ * Capabilities of the terminal we are running in, detected from the environment
+ * and the terminfo database.
+ * Doubles as a sequence writer that drops the sequences the terminal does not
+ * support before passing the rest on to :var:`temaku_write_ansi_sequence`.
+ */
+struct temaku_terminal {
+    temaku_sequence_writer_t sequence_writer;
+    int colors;
+    bool bold;
+    bool dim;
+    bool italic;
+    bool underline;
+    bool reverse;
+    bool strikethrough;
+    bool links;
+};
+
+static int temaku_terminfo_short(const unsigned char *p)
+{
+    int val = p[0] | p[1] << 8;
+    return val >= 0x8000 ? val - 0x10000 : val;
+}
+static long temaku_terminfo_int(const unsigned char *p)
+{
+    return (long)(int32_t)((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+}
+/* Return whether string capability @{index} is present in the compiled terminfo entry @{buf} */
+static bool temaku_terminfo_string(const unsigned char *strings, int count, int index)
+{
+    return index < count && temaku_terminfo_short(strings + 2 * index) >= 0;
+}
+/* Parse the compiled terminfo entry in @{buf}, see term(5) for the format */
+static bool temaku_terminfo_parse(temaku_terminal_t *term, const unsigned char *buf, size_t size)
+{
+    enum {
+        TI_MAX_COLORS = 13,
+        TI_ENTER_BOLD_MODE = 27,
+        TI_ENTER_DIM_MODE = 30,
+        TI_ENTER_REVERSE_MODE = 34,
+        TI_ENTER_UNDERLINE_MODE = 36,
+        TI_ENTER_ITALICS_MODE = 311,
+    };
+    int magic, names_size, bool_count, num_count, str_count, strtab_size, num_size;
+    const unsigned char *p = buf, *end = buf + size;
+    const unsigned char *nums, *strings, *strtab;
+    if (size < 12) return false;
+    magic = temaku_terminfo_short(p);
+    if (magic == 0432) num_size = 2;
+    else if (magic == 01036) num_size = 4;
+    else return false;
+    names_size = temaku_terminfo_short(p + 2);
+    bool_count = temaku_terminfo_short(p + 4);
+    num_count = temaku_terminfo_short(p + 6);
+    str_count = temaku_terminfo_short(p + 8);
+    strtab_size = temaku_terminfo_short(p + 10);
+    if (names_size < 0 || bool_count < 0 || num_count < 0 || str_count < 0 || strtab_size < 0) return false;
+    p += 12 + names_size + bool_count;
+    p += (p - buf) & 1;
+    nums = p;
+    strings = nums + num_size * num_count;
+    strtab = strings + 2 * str_count;
+    if (strtab + strtab_size > end) return false;
+    if (TI_MAX_COLORS < num_count) {
+        long colors = num_size == 2 ? temaku_terminfo_short(nums + 2 * TI_MAX_COLORS) : temaku_terminfo_int(nums + 4 * TI_MAX_COLORS);
+        term->colors = colors > 0 ? (colors > 0x1000000 ? 0x1000000 : (int)colors) : 0;
+    }
+    term->bold = temaku_terminfo_string(strings, str_count, TI_ENTER_BOLD_MODE);
+    term->dim = temaku_terminfo_string(strings, str_count, TI_ENTER_DIM_MODE);
+    term->reverse = temaku_terminfo_string(strings, str_count, TI_ENTER_REVERSE_MODE);
+    term->underline = temaku_terminfo_string(strings, str_count, TI_ENTER_UNDERLINE_MODE);
+    term->italic = temaku_terminfo_string(strings, str_count, TI_ENTER_ITALICS_MODE);
+    term->strikethrough = false;
+    /* Strikethrough is the user-defined capability "smxx" in the extended section */
+    p = strtab + strtab_size;
+    p += (p - buf) & 1;
+    if (p + 10 <= end) {
+        int ext_bool_count = temaku_terminfo_short(p);
+        int ext_num_count = temaku_terminfo_short(p + 2);
+        int ext_str_count = temaku_terminfo_short(p + 4);
+        int ext_strtab_size = temaku_terminfo_short(p + 8);
+        const unsigned char *ext_strings, *ext_names, *ext_strtab, *ext_end, *names;
+        if (ext_bool_count < 0 || ext_num_count < 0 || ext_str_count < 0 || ext_strtab_size < 0) return true;
+        p += 10 + ext_bool_count;
+        p += (p - buf) & 1;
+        ext_strings = p + num_size * ext_num_count;
+        ext_names = ext_strings + 2 * ext_str_count;
+        ext_strtab = ext_names + 2 * (ext_bool_count + ext_num_count + ext_str_count);
+        ext_end = ext_strtab + ext_strtab_size;
+        if (ext_end > end) return true;
+        /* The names follow the string values in the string table */
+        names = ext_strtab;
+        for (int i=0; i < ext_str_count; i++) {
+            int offset = temaku_terminfo_short(ext_strings + 2 * i);
+            if (offset >= 0 && ext_strtab + offset < ext_end) {
+                const unsigned char *value_end = (const unsigned char *)memchr(ext_strtab + offset, '\0', ext_end - ext_strtab - offset);
+                if (value_end && value_end + 1 > names) names = value_end + 1;
+            }
+        }
+        for (int i=0; i < ext_str_count; i++) {
+            int offset = temaku_terminfo_short(ext_names + 2 * (ext_bool_count + ext_num_count + i));
+            if (offset < 0 || names + offset + sizeof("smxx") > ext_end) continue;
+            if (memcmp(names + offset, "smxx", sizeof("smxx")) == 0) {
+                term->strikethrough = temaku_terminfo_short(ext_strings + 2 * i) >= 0;
+                break;
+            }
+        }
+    }
+    return true;
+}
+static bool temaku_terminfo_load(temaku_terminal_t *term, const char *dir, const char *name)
+{
+    static unsigned char buf[32768];
+    char path[4096];
+    size_t size;
+    FILE *fp;
+    if (!dir || !*dir) return false;
+    snprintf(path, sizeof(path), "%s/%c/%s", dir, name[0], name);
+    fp = fopen(path, "rb");
+    if (!fp) {
+        /* Some systems use the hexadecimal value of the first character as directory */
+        snprintf(path, sizeof(path), "%s/%02x/%s", dir, (unsigned char)name[0], name);
+        fp = fopen(path, "rb");
+    }
+    if (!fp) return false;
+    size = fread(buf, 1, sizeof(buf), fp);
+    fclose(fp);
+    return temaku_terminfo_parse(term, buf, size);
+}
+static bool temaku_terminfo_find(temaku_terminal_t *term, const char *name)
+{
+    static const char *dirs[] = {
+        "/etc/terminfo",
+        "/lib/terminfo",
+        "/usr/share/terminfo",
+        "/usr/lib/terminfo",
+        "/usr/share/lib/terminfo",
+        NULL
+    };
+    char path[4096];
+    const char *env;
+    if (strchr(name, '/') || strstr(name, "..")) return false;
+    if (temaku_terminfo_load(term, getenv("TERMINFO"), name)) return true;
+    if ((env = getenv("HOME"))) {
+        snprintf(path, sizeof(path), "%s/.terminfo", env);
+        if (temaku_terminfo_load(term, path, name)) return true;
+    }
+    if ((env = getenv("TERMINFO_DIRS"))) {
+        while (*env) {
+            size_t len = strcspn(env, ":");
+            if (len < sizeof(path)) {
+                memcpy(path, env, len);
+                path[len] = '\0';
+                if (temaku_terminfo_load(term, path, name)) return true;
+            }
+            env += len + !!env[len];
+        }
+    }
+    for (int i=0; dirs[i]; i++) {
+        if (temaku_terminfo_load(term, dirs[i], name)) return true;
+    }
+    return false;
+}
+/* Terminals that are known to support OSC 8 hyperlinks */
+static bool temaku_terminal_links(const char *name)
+{
+    const char *env;
+    if (strstr(name, "kitty") || strstr(name, "foot") || strstr(name, "wezterm") || strstr(name, "alacritty")) return true;
+    if (getenv("KITTY_WINDOW_ID") || getenv("WT_SESSION") || getenv("WEZTERM_PANE")) return true;
+    if ((env = getenv("VTE_VERSION")) && atoi(env) >= 5000) return true;
+    if ((env = getenv("TERM_PROGRAM"))) {
+        if (strcmp(env, "iTerm.app") == 0 || strcmp(env, "vscode") == 0 || strcmp(env, "WezTerm") == 0 || strcmp(env, "ghostty") == 0) return true;
+    }
+    return false;
+}
+static void temaku_terminal_detect(temaku_terminal_t *term)
+{
+    const char *name = getenv("TERM");
+    const char *env;
+    term->colors = 0;
+    term->bold = term->dim = term->italic = term->underline = term->reverse = term->strikethrough = term->links = false;
+    if (!name || !*name || strcmp(name, "dumb") == 0) return;
+    if (!temaku_terminfo_find(term, name)) {
+        /* No terminfo entry, assume the usual ANSI subset */
+        term->bold = term->underline = term->reverse = true;
+        if (strstr(name, "color") || strstr(name, "xterm") || strstr(name, "screen") || strstr(name, "tmux") || strstr(name, "rxvt") || strcmp(name, "linux") == 0) {
+            term->colors = 8;
+            term->dim = true;
+        }
+    }
+    if ((env = getenv("COLORTERM")) && *env && term->colors < 256) term->colors = 256;
+    if ((env = getenv("NO_COLOR")) && *env) term->colors = 0;
+    term->links = temaku_terminal_links(name);
+}
+static int temaku_terminal_sequence_cb(TEMAKU_SELF *self, temaku_options_t *options, temaku_writer_t *writer, enum temaku_sequence seq, void *arg)
+{
+    temaku_terminal_t *term = (temaku_terminal_t *)self;
+    int color;
+    switch (seq) {
+    case TEMAKU_BOLD_START: case TEMAKU_BOLD_END: if (!term->bold) return 0; break;
+    case TEMAKU_ITALIC_START: case TEMAKU_ITALIC_END: if (!term->italic) return 0; break;
+    case TEMAKU_UNDERLINE_START: case TEMAKU_UNDERLINE_END: if (!term->underline) return 0; break;
+    case TEMAKU_STRIKETHROUGH_START: case TEMAKU_STRIKETHROUGH_END: if (!term->strikethrough) return 0; break;
+    case TEMAKU_REVERSE_VIDEO_START: case TEMAKU_REVERSE_VIDEO_END: if (!term->reverse) return 0; break;
+    case TEMAKU_ALTERNATIVE_START: case TEMAKU_ALTERNATIVE_END: if (!term->dim) return 0; break;
+    case TEMAKU_FGCOLOR_START:
+    case TEMAKU_BGCOLOR_START:
+        /* Fall back to the non-bright colors on 8 color terminals */
+        color = *(int *)arg;
+        if (term->colors < 16 && color >= 8) color -= 8;
+        arg = &color;
+        break;
+    default: break;
+    }
+    return (*temaku_write_ansi_sequence)((TEMAKU_SELF *)&temaku_write_ansi_sequence, options, writer, seq, arg);
+}
+
+/*
+ * The terminal we are running in, detected on the first call.
+ * The cache is per translation unit, not thread-safe: call this once before starting threads,
+ * and pass the result around rather than calling it from several files.
+ */
+static temaku_terminal_t *temaku_terminal(void)
+{
+    static temaku_terminal_t term;
+    static bool detected = false;
+    if (!detected) {
+        term.sequence_writer = temaku_terminal_sequence_cb;
+        temaku_terminal_detect(&term);
+        detected = true;
+    }
+    return &term;
+}
+/* Options for writing to @{fd}, with all sequences the destination can't display disabled */
+static temaku_options_t temaku_detect_options(int fd)
+{
+    temaku_options_t options = TEMAKU_DEFAULT_OPTIONS;
+    temaku_terminal_t *term = temaku_terminal();
+    if (!temaku_isatty(fd) || !getenv("TERM") || strcmp(getenv("TERM"), "dumb") == 0) {
+        options.do_markup = false;
+        return options;
+    }
+    options.sequence_writer = &term->sequence_writer;
+    options.do_color = term->colors >= 8;
+    options.do_links = term->links;
+    return options;
+}
+
 #endif /* TEMAKU_LIBC_H */
@@ -2,6 +2,22 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#define TEMAKU_SSSE3 1
+#define TEMAKU_TARGET_SSSE3
+#elif defined(__SSE2__) && defined(__GNUC__)
+/* Not enabled at compile time, but almost every x86 CPU has it, so check at runtime */
+#include <tmmintrin.h>
+#define TEMAKU_SSSE3 1
+#define TEMAKU_SSSE3_DISPATCH 1
+#define TEMAKU_TARGET_SSSE3 __attribute__((target("ssse3")))
+#endif
 
 // Undocumented symbols
 TEMAKU_API(int) temaku_write_ansi_sequence_cb(TEMAKU_SELF *self, struct temaku_options *options, temaku_writer_t *writer, enum temaku_sequence seq, void *arg);
@@ -42,16 +58,192 @@ static inline bool strequalni(const char *a, const char *b, size_t n)
     for (;;) {
         if (!n) return true;
         if (!*a && !*b) return true;
-        if (tolower(*a) != tolower(*b)) return false;
+        if (*a != *b && tolower(*a) != tolower(*b)) return false;
         a++, b++, n--;
     }
     return true;
 }
 
-static bool temaku_wordchar(struct temaku_options *options, const char *str)
+static inline char temaku_peek(const char *s, const char *end)
+{
+    return s < end ? *s : '\0';
+}
+/* The length of the UTF-8 character at @{s}, or 0 if it is invalid or doesn't fit in @{size} bytes */
+static inline size_t temaku_utf8_char(const unsigned char *s, size_t size)
 {
-    if (strchr(options->wordchars, '%') && str[0] == '%') return str[1] == '%';
-    return strchr(options->wordchars, str[0]);
+    unsigned char c = s[0];
+    if (c < 0x80) return 1;
+    if (c < 0xc2 || c > 0xf4) return 0;
+    if (size < 2 || (s[1] & 0xc0) != 0x80) return 0;
+    if (c < 0xe0) return 2;
+    /* Overlong encodings, surrogates and code points past U+10FFFF */
+    if ((c == 0xe0 && s[1] < 0xa0) || (c == 0xed && s[1] >= 0xa0)) return 0;
+    if ((c == 0xf0 && s[1] < 0x90) || (c == 0xf4 && s[1] >= 0x90)) return 0;
+    if (size < 3 || (s[2] & 0xc0) != 0x80) return 0;
+    if (c < 0xf0) return 3;
+    if (size < 4 || (s[3] & 0xc0) != 0x80) return 0;
+    return 4;
+}
+/* Whether the @{size} byte UTF-8 character at @{ch} is one of @{wordchars} */
+static bool temaku_wordchars_has(const char *wordchars, const char *ch, size_t size)
+{
+    if (size == 1) return strchr(wordchars, ch[0]);
+    for (const char *p = strchr(wordchars, ch[0]); p; p = strchr(p + 1, ch[0])) {
+        if (strncmp(p, ch, size) == 0) return true;
+    }
+    return false;
+}
+/* Build the bitmap of the ASCII word characters, so that looking one up doesn't cost a strchr */
+static void temaku_wordset_init(struct temaku_stream *stream)
+{
+    const char *wordchars = stream->options->wordchars;
+    memset(stream->wordset, 0, sizeof(stream->wordset));
+    /* Like strchr, which finds the NUL terminator too */
+    stream->wordset[0] = 1;
+    for (const unsigned char *p = (const unsigned char *)wordchars; *p; p++) {
+        if (*p < 0x80) stream->wordset[*p >> 3] |= 1 << (*p & 7);
+    }
+    stream->wordchars = wordchars;
+}
+/* Whether the ASCII character @{c} is one of the word characters */
+static inline bool temaku_wordset_has(struct temaku_stream *stream, unsigned char c)
+{
+    if (stream->wordchars != stream->options->wordchars) temaku_wordset_init(stream);
+    return stream->wordset[c >> 3] & (1 << (c & 7));
+}
+static bool temaku_wordchar(struct temaku_stream *stream, const char *str, const char *end)
+{
+    char c = temaku_peek(str, end);
+    size_t size;
+    if (c == '%' && temaku_wordset_has(stream, '%')) return temaku_peek(str + 1, end) == '%';
+    if ((unsigned char)c < 0x80) return temaku_wordset_has(stream, c);
+    /* Multibyte characters only match as a whole */
+    size = temaku_utf8_char((const unsigned char *)str, end - str);
+    return size && temaku_wordchars_has(stream->options->wordchars, str, size);
+}
+/* Whether the last character of the text in [@{start}, @{end}) is a word character */
+static bool temaku_wordchar_last(struct temaku_stream *stream, const char *start, const char *end)
+{
+    const char *p = end - 1;
+    if ((unsigned char)*p < 0x80) return temaku_wordset_has(stream, *p);
+    while (p > start && end - p < 4 && ((unsigned char)*p & 0xc0) == 0x80) --p;
+    return temaku_utf8_char((const unsigned char *)p, end - p) == (size_t)(end - p) &&
+           temaku_wordchars_has(stream->options->wordchars, p, end - p);
+}
+
+#if defined(TEMAKU_SSSE3)
+/*
+ * Finds invalid UTF-8 in 16 bytes at once, by looking up the high and low
+ * nibbles of each byte and the high nibble of the byte before it in
+ * tables of the errors they are compatible with, see
+ * "Validating UTF-8 In Less Than One Instruction Per Byte" (Keiser, Lemire).
+ * Returns non-zero bytes where @{input} (preceded by @{prev}) has an error.
+ */
+TEMAKU_TARGET_SSSE3 static inline __m128i temaku_utf8_check(__m128i input, __m128i prev)
+{
+    enum {
+        TOO_SHORT  = 1 << 0, /* 11______ 0_______ or 11______ 11______ */
+        TOO_LONG   = 1 << 1, /* 0_______ 10______ */
+        OVERLONG_3 = 1 << 2, /* 11100000 100_____ */
+        SURROGATE  = 1 << 4, /* 11101101 101_____ */
+        OVERLONG_2 = 1 << 5, /* 1100000_ 10______ */
+        TWO_CONTS  = 1 << 7, /* 10______ 10______ */
+        TOO_LARGE  = 1 << 3, /* 11110100 1001____, 11110100 101_____ or 11110101+ */
+        TOO_LARGE_1000 = 1 << 6, /* 11110101+ 1000____ */
+        OVERLONG_4 = 1 << 6, /* 11110000 1000____ */
+        CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS,
+    };
+    const __m128i byte_1_high_table = _mm_setr_epi8(
+        TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+        TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+        TOO_SHORT | OVERLONG_2,
+        TOO_SHORT,
+        TOO_SHORT | OVERLONG_3 | SURROGATE,
+        (char)(TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4));
+    const __m128i byte_1_low_table = _mm_setr_epi8(
+        (char)(CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4),
+        (char)(CARRY | OVERLONG_2),
+        (char)CARRY, (char)CARRY,
+        (char)(CARRY | TOO_LARGE),
+        (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        (char)(CARRY | TOO_LARGE | TOO_LARGE_1000), (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        (char)(CARRY | TOO_LARGE | TOO_LARGE_1000), (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        (char)(CARRY | TOO_LARGE | TOO_LARGE_1000), (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        (char)(CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE),
+        (char)(CARRY | TOO_LARGE | TOO_LARGE_1000), (char)(CARRY | TOO_LARGE | TOO_LARGE_1000));
+    const __m128i byte_2_high_table = _mm_setr_epi8(
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+        (char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4),
+        (char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE),
+        (char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE),
+        (char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE),
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT);
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    __m128i prev1 = _mm_alignr_epi8(input, prev, 15);
+    __m128i byte_1_high = _mm_shuffle_epi8(byte_1_high_table, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble));
+    __m128i byte_1_low = _mm_shuffle_epi8(byte_1_low_table, _mm_and_si128(prev1, nibble));
+    __m128i byte_2_high = _mm_shuffle_epi8(byte_2_high_table, _mm_and_si128(_mm_srli_epi16(input, 4), nibble));
+    __m128i special = _mm_and_si128(_mm_and_si128(byte_1_high, byte_1_low), byte_2_high);
+    /* The second and third byte after a 3 or 4 byte lead must be continuation bytes, where TWO_CONTS is expected */
+    __m128i third = _mm_subs_epu8(_mm_alignr_epi8(input, prev, 14), _mm_set1_epi8(0xe0 - 0x80));
+    __m128i fourth = _mm_subs_epu8(_mm_alignr_epi8(input, prev, 13), _mm_set1_epi8((char)(0xf0 - 0x80)));
+    __m128i must_continue = _mm_and_si128(_mm_or_si128(third, fourth), _mm_set1_epi8((char)0x80));
+    return _mm_xor_si128(must_continue, special);
+}
+/* Validate 16 bytes at a time, returning where to continue one character at a time */
+TEMAKU_TARGET_SSSE3 static size_t temaku_utf8_valid_ssse3(const unsigned char *s, size_t size)
+{
+    /* Bytes that would start a character that doesn't fit in the rest of the block */
+    const __m128i incomplete_max = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                                 (char)(0xf0 - 1), (char)(0xe0 - 1), (char)(0xc0 - 1));
+    __m128i prev = _mm_setzero_si128(), incomplete = _mm_setzero_si128();
+    size_t i, start;
+    for (i=0; i + 16 <= size; i += 16) {
+        __m128i input = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i error;
+        if (_mm_movemask_epi8(input) == 0) {
+            /* All ASCII, only a character left incomplete by the previous block is an error */
+            error = incomplete;
+        } else {
+            error = temaku_utf8_check(input, prev);
+        }
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) != 0xffff) break;
+        incomplete = _mm_subs_epu8(input, incomplete_max);
+        prev = input;
+    }
+    /* Everything before the first character that isn't known to be complete and valid is fine */
+    if (i < 3) return 0;
+    for (start = i - 3; start < i && (s[start] & 0xc0) == 0x80; start++);
+    return start;
+}
+#endif
+TEMAKU_FUN(size_t) temaku_utf8_valid(const char *data, size_t size)
+{
+    const unsigned char *s = (const unsigned char *)data;
+    size_t i = 0;
+#if defined(TEMAKU_SSSE3_DISPATCH)
+    static int has_ssse3 = -1;
+    if (has_ssse3 < 0) has_ssse3 = __builtin_cpu_supports("ssse3");
+    if (has_ssse3) i = temaku_utf8_valid_ssse3(s, size);
+    /* Skip over ASCII, which needs no validation */
+    else while (i + 16 <= size && _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(s + i))) == 0) i += 16;
+#elif defined(TEMAKU_SSSE3)
+    i = temaku_utf8_valid_ssse3(s, size);
+#elif defined(__SSE2__)
+    /* Skip over ASCII, which needs no validation */
+    while (i + 16 <= size && _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(s + i))) == 0) i += 16;
+#endif
+    while (i < size) {
+        size_t n;
+        if (s[i] < 0x80) {
+            i++;
+            continue;
+        }
+        if (!(n = temaku_utf8_char(s + i, size - i))) break;
+        i += n;
+    }
+    return i;
 }
 
 TEMAKU_FUN(int) temaku_write(temaku_writer_t *self, const void *data, size_t size)
@@ -80,26 +272,34 @@ TEMAKU_FUN(int) temaku_writehex(temaku_writer_t *self, int val)
 }
 TEMAKU_FUN(int) temaku_writeurl(temaku_writer_t *self, const char *url, size_t size)
 {
+    static const char hex[] = "0123456789ABCDEF";
     int nwritten = 0;
+    size_t start = 0;
     for (size_t i=0; i < size; i++) {
-        if (url[i] <= 0x20 || url[i] >= 0x7f || url[i] == '<' || url[i] == '>' || url[i] == '%' || url[i] == '"') {
-            temaku_writechar(self, '%');
-            nwritten += temaku_writehex(self, url[i]);
-        } else {
-            nwritten += temaku_writechar(self, url[i]);
-        }
+        /* Unsigned, so UTF-8 bytes are percent-encoded like any other byte past 0x7f */
+        unsigned char c = url[i];
+        char escape[3];
+        if (!(c <= 0x20 || c >= 0x7f || c == '<' || c == '>' || c == '%' || c == '"')) continue;
+        if (i != start) nwritten += temaku_write(self, url + start, i - start);
+        escape[0] = '%';
+        escape[1] = hex[c >> 4];
+        escape[2] = hex[c & 0xf];
+        nwritten += temaku_write(self, escape, 3);
+        start = i + 1;
     }
+    if (size != start) nwritten += temaku_write(self, url + start, size - start);
     return nwritten;
 }
 TEMAKU_FUN(int) temaku_write_ansi_sequence_cb(TEMAKU_SELF *self, struct temaku_options *options, temaku_writer_t *writer, enum temaku_sequence seq, void *arg)
 {
+    /* Whole sequences, so that a color is a single write */
     static const char *fgcolors[16] = {
-        "30", "31", "32", "33", "34", "35", "36", "37",
-        "90", "91", "92", "93", "94", "95", "96", "97",
+        "\x1b[30m", "\x1b[31m", "\x1b[32m", "\x1b[33m", "\x1b[34m", "\x1b[35m", "\x1b[36m", "\x1b[37m",
+        "\x1b[90m", "\x1b[91m", "\x1b[92m", "\x1b[93m", "\x1b[94m", "\x1b[95m", "\x1b[96m", "\x1b[97m",
     };
     static const char *bgcolors[16] = {
-        "40", "41", "42", "43", "44", "45", "46", "47",
-        "100", "101", "102", "103", "104", "105", "106", "107",
+        "\x1b[40m", "\x1b[41m", "\x1b[42m", "\x1b[43m", "\x1b[44m", "\x1b[45m", "\x1b[46m", "\x1b[47m",
+        "\x1b[100m", "\x1b[101m", "\x1b[102m", "\x1b[103m", "\x1b[104m", "\x1b[105m", "\x1b[106m", "\x1b[107m",
     };
     int nwritten = 0;
     (void)self;
@@ -129,22 +329,14 @@ TEMAKU_FUN(int) temaku_write_ansi_sequence_cb(TEMAKU_SELF *self, struct temaku_o
     case TEMAKU_FGCOLOR_START:
         {
             int fgcolor = *(int *)arg;
-            if (fgcolor != -1) {
-                nwritten += temaku_writestr(writer, "\x1b[");
-                nwritten += temaku_writestr(writer, fgcolors[fgcolor % 16]);
-                nwritten += temaku_writestr(writer, "m");
-            }
+            if (fgcolor != -1) nwritten += temaku_writestr(writer, fgcolors[fgcolor % 16]);
         }
         break;
     case TEMAKU_FGCOLOR_END: return temaku_writestr(writer, "\x1b[39m");
     case TEMAKU_BGCOLOR_START:
         {
             int bgcolor = *(int *)arg;
-            if (bgcolor != -1) {
-                nwritten += temaku_writestr(writer, "\x1b[");
-                nwritten += temaku_writestr(writer, bgcolors[bgcolor % 16]);
-                nwritten += temaku_writestr(writer, "m");
-            }
+            if (bgcolor != -1) nwritten += temaku_writestr(writer, bgcolors[bgcolor % 16]);
         }
         break;
     case TEMAKU_BGCOLOR_END: return temaku_writestr(writer, "\x1b[49m");
@@ -165,6 +357,22 @@ TEMAKU_FUN(int) temaku_write_ansi_sequence_cb(TEMAKU_SELF *self, struct temaku_o
     }
     return nwritten;
 }
+/* Find the first character in [@{s}, @{end}) that needs escaping in HTML */
+static inline const char *temaku_html_scan(const char *s, const char *end)
+{
+#if defined(__SSE2__)
+    const __m128i lt = _mm_set1_epi8('<'), gt = _mm_set1_epi8('>'), amp = _mm_set1_epi8('&');
+    while (end - s >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)s);
+        __m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, lt), _mm_cmpeq_epi8(v, gt)), _mm_cmpeq_epi8(v, amp));
+        int mask = _mm_movemask_epi8(special);
+        if (mask) return s + __builtin_ctz(mask);
+        s += 16;
+    }
+#endif
+    while (s < end && *s != '<' && *s != '>' && *s != '&') ++s;
+    return s;
+}
 TEMAKU_FUN(int) temaku_write_html_sequence_cb(TEMAKU_SELF *self, struct temaku_options *options, temaku_writer_t *writer, enum temaku_sequence seq, void *arg)
 {
     static const char *fgcolors[16] = {
@@ -212,22 +420,23 @@ TEMAKU_FUN(int) temaku_write_html_sequence_cb(TEMAKU_SELF *self, struct temaku_o
     case TEMAKU_DATA:
         {
             struct temaku_string *data = (struct temaku_string *)arg;
-            for (size_t i=0; i < data->size; i++) {
-                char c = data->base[i];
-                switch (c) {
-                case '<':
-                    nwritten += temaku_writestr(writer, "&lt;");
-                    break;
-                case '>':
-                    nwritten += temaku_writestr(writer, "&gt;");
-                    break;
-                case '&':
-                    nwritten += temaku_writestr(writer, "&amp;");
-                    break;
-                default:
-                    nwritten += temaku_writechar(writer, c);
-                    break;
+            const char *s = data->base;
+            const char *end = data->base + data->size;
+            /*
+             * Only <>& are escaped. Everything else, including bytes that aren't valid UTF-8,
+             * is passed through unchanged, so the output doesn't depend on where the data is split.
+             */
+            while (s < end) {
+                /* Write everything up to the next escaped character in one go */
+                const char *special = temaku_html_scan(s, end);
+                if (special != s) nwritten += temaku_write(writer, s, special - s);
+                if (special == end) break;
+                switch (*special) {
+                case '<': nwritten += temaku_writestr(writer, "&lt;"); break;
+                case '>': nwritten += temaku_writestr(writer, "&gt;"); break;
+                default: nwritten += temaku_writestr(writer, "&amp;"); break;
                 }
+                s = special + 1;
             }
         }
         break;
@@ -301,11 +510,139 @@ TEMAKU_FUN(int) temaku_writesequence(struct temaku_options *options, temaku_writ
 {
     return (*options->sequence_writer)((TEMAKU_SELF*)options->sequence_writer, options, writer, seq, arg);
 }
-TEMAKU_FUN(int) temaku_markup(struct temaku_options *options, temaku_writer_t *writer, const char *markup, size_t markuplen)
+TEMAKU_FUN(int) temaku_writedata(struct temaku_options *options, temaku_writer_t *writer, const char *data, size_t size)
 {
+    struct temaku_string str;
+    str.base = data;
+    str.size = size ? size : strlen(data);
+    if (!str.size) return 0;
+    return temaku_writesequence(options, writer, TEMAKU_DATA, &str);
+}
+TEMAKU_FUN(int) temaku_writedataint(struct temaku_options *options, temaku_writer_t *writer, long long val)
+{
+    char buffer[24];
+    snprintf(buffer, sizeof(buffer), "%lld", val);
+    return temaku_writedata(options, writer, buffer, 0);
+}
+
 #define TEMAKU_DO_COLOR(block) if (options->do_markup && options->do_color) do { block; } while (0)
 #define TEMAKU_DO_STYLE(block) if (options->do_markup && options->do_style) do { block; } while (0)
 #define TEMAKU_DO_LINKS(block) if (options->do_markup && options->do_links) do { block; } while (0)
+
+enum {
+    CTX_HEADER      = 0x1,
+    CTX_BOLD        = 0x2,
+    CTX_ITALIC      = 0x4,
+    CTX_UNDERLINE   = 0x8,
+    CTX_ALTERNATIVE = 0x10,
+    CTX_BGLINE      = 0x20,
+};
+
+/* Characters that may start a markup sequence, everything else is plain text */
+static const bool temaku_special[256] = {
+    ['\0'] = true,
+    ['\n'] = true,
+    ['%'] = true,
+    ['*'] = true,
+    ['/'] = true,
+    ['_'] = true,
+    ['|'] = true,
+    ['='] = true,
+};
+
+/* Find the first character in [@{s}, @{end}) that may start a markup sequence */
+static inline const char *temaku_scan(const char *s, const char *end)
+{
+#if defined(__SSE2__)
+    /* Dense markup has short gaps, which are cheaper to scan a byte at a time */
+    for (const char *gap = end - s > 16 ? s + 16 : end; s < gap; ++s) {
+        if (temaku_special[(unsigned char)*s]) return s;
+    }
+    const __m128i nul = _mm_set1_epi8('\0'), newline = _mm_set1_epi8('\n');
+    const __m128i percent = _mm_set1_epi8('%'), star = _mm_set1_epi8('*');
+    const __m128i slash = _mm_set1_epi8('/'), underscore = _mm_set1_epi8('_');
+    const __m128i bar = _mm_set1_epi8('|'), equals = _mm_set1_epi8('=');
+    while (end - s >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)s);
+        __m128i a = _mm_or_si128(_mm_cmpeq_epi8(v, nul), _mm_cmpeq_epi8(v, newline));
+        __m128i b = _mm_or_si128(_mm_cmpeq_epi8(v, percent), _mm_cmpeq_epi8(v, star));
+        __m128i c = _mm_or_si128(_mm_cmpeq_epi8(v, slash), _mm_cmpeq_epi8(v, underscore));
+        __m128i d = _mm_or_si128(_mm_cmpeq_epi8(v, bar), _mm_cmpeq_epi8(v, equals));
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d)));
+        if (mask) return s + __builtin_ctz(mask);
+        s += 16;
+    }
+#endif
+    while (s < end && !temaku_special[(unsigned char)*s]) ++s;
+    return s;
+}
+/* Write the pending run of plain text @{run}, if any */
+static int temaku_flush(struct temaku_options *options, temaku_writer_t *writer, struct temaku_string *run)
+{
+    int nwritten = 0;
+    if (run->size) nwritten = temaku_writesequence(options, writer, TEMAKU_DATA, run);
+    run->size = 0;
+    return nwritten;
+}
+static int temaku_stream_start(struct temaku_stream *stream, struct temaku_options *options, temaku_writer_t *writer, struct temaku_string *text)
+{
+    if (options == NULL) options = &temaku_default_options;
+    stream->options = options;
+    stream->writer = writer;
+    stream->row = 0;
+    stream->column = 0;
+    stream->fgcolor = -1;
+    stream->bgcolor = -1;
+    stream->ctx = 0;
+    stream->in_word = false;
+    stream->in_raw = false;
+    stream->raw_last = '\0';
+    stream->wordchars = NULL;
+    stream->resolver = NULL;
+    return temaku_writesequence(options, writer, TEMAKU_START, text);
+}
+static int temaku_stream_finish(struct temaku_stream *stream, struct temaku_string *text)
+{
+    struct temaku_options *options = stream->options;
+    temaku_writer_t *writer = stream->writer;
+    int nwritten = 0;
+    if (stream->in_raw && stream->raw_last == '%') {
+        /* The input ended before the '%' could become part of a terminator */
+        nwritten += temaku_write(writer, "%", 1);
+    } else if (!stream->in_raw && stream->raw_last == '}') {
+        nwritten += temaku_write(writer, "%}", 2);
+    }
+    stream->in_raw = false;
+    stream->raw_last = '\0';
+    if (stream->ctx & CTX_HEADER)
+        TEMAKU_DO_STYLE(nwritten += temaku_writesequence(options, writer, TEMAKU_HEADER_END, NULL));
+    if (stream->ctx & CTX_BOLD)
+        TEMAKU_DO_STYLE(nwritten += temaku_writesequence(options, writer, TEMAKU_BOLD_END, NULL));
+    if (stream->ctx & CTX_ITALIC)
+        TEMAKU_DO_STYLE(nwritten += temaku_writesequence(options, writer, TEMAKU_ITALIC_END, NULL));
+    if (stream->ctx & CTX_UNDERLINE)
+        TEMAKU_DO_STYLE(nwritten += temaku_writesequence(options, writer, TEMAKU_UNDERLINE_END, NULL));
+    if (stream->ctx & CTX_ALTERNATIVE)
+        TEMAKU_DO_STYLE(nwritten += temaku_writesequence(options, writer, TEMAKU_ALTERNATIVE_END, NULL));
+    if (stream->ctx & CTX_BGLINE)
+        TEMAKU_DO_COLOR(nwritten += temaku_writesequence(options, writer, TEMAKU_BGLINE_END, NULL));
+    stream->ctx = 0;
+    nwritten += temaku_writesequence(options, writer, TEMAKU_END, text);
+    return nwritten;
+}
+
+TEMAKU_FUN(int) temaku_stream_begin(struct temaku_stream *stream, struct temaku_options *options, temaku_writer_t *writer)
+{
+    struct temaku_string text = { "", 0 };
+    return temaku_stream_start(stream, options, writer, &text);
+}
+/*
+ * Process the markup in [@{markup}, @{end}), stopping early at the first
+ * sequence that starts at or after @{limit}.
+ * Stores where processing stopped in @{stop}.
+ */
+static int temaku_stream_feed(struct temaku_stream *stream, const char *markup, const char *end, const char *limit, const char **stop)
+{
     static const char *color_names[] = {
         "black",
         "red",
@@ -317,249 +654,1380 @@ TEMAKU_FUN(int) temaku_markup(struct temaku_options *options, temaku_writer_t *w
         "white",
         NULL
     };
-    int row = 0, column = 0;
-    int fgcolor = -1;
-    int bgcolor = -1;
+    struct temaku_options *options = stream->options;
+    temaku_writer_t *writer = stream->writer;
     const char *s = markup;
-    bool in_word = false;
-    unsigned ctx = 0;
+    struct temaku_string run = { markup, 0 };
     struct temaku_string data = { NULL, 0 };
-    if (markuplen == 0 || markuplen == SIZE_MAX) {
-        markuplen = strlen(markup);
+    /* The last run of plain text, in_word is only worked out from it when something needs it */
+    struct temaku_string word = { NULL, 0 };
+    int nwritten = 0;
+#define TEMAKU_IN_WORD() (word.base ? (stream->in_word = temaku_wordchar_last(stream, word.base, word.base + word.size), word.base = NULL, stream->in_word) : stream->in_word)
+#define TEMAKU_EMIT(seq, arg) (nwritten += temaku_flush(options, writer, &run), nwritten += temaku_writesequence(options, writer, seq, arg))
+#define TEMAKU_PUT(p) do { if (run.base + run.size != (p)) { nwritten += temaku_flush(options, writer, &run); run.base = (p); } run.size++; } while (0)
+    if (!stream->in_raw && stream->raw_last == '}' && s < end) {
+        /* The previous chunk ended with a terminator, which is only written if the input ends there */
+        if (!*s) nwritten += temaku_write(writer, "%}", 2);
+        stream->raw_last = '\0';
     }
-    if (options == NULL) options = &temaku_default_options;
-    enum {
-        CTX_HEADER      = 0x1,
-        CTX_BOLD        = 0x2,
-        CTX_ITALIC      = 0x4,
-        CTX_UNDERLINE   = 0x8,
-        CTX_ALTERNATIVE = 0x10,
-        CTX_BGLINE      = 0x20,
-    };
-    data.base = markup;
-    data.size = markuplen;
-    temaku_writesequence(options, writer, TEMAKU_START, &data);
-    while (*s) {
+    while (s < limit && *s) {
         const char *seq = s;
-        char c = *s;
+        char c;
+        if (stream->in_raw) {
+            /* Inside of %{ ... %}, find the terminator and write everything in between as-is */
+            const char *start = s;
+            bool closed = false;
+            bool deferred = stream->raw_last == '%';
+            char last = stream->raw_last;
+            size_t size, drop = 0;
+            while (s < limit && *s) {
+                char b = *s++;
+                if (last == '%' && b == '}') {
+                    closed = true;
+                    break;
+                }
+                last = b;
+            }
+            size = s - start;
+            /* A trailing '%' is not written until we know whether a '}' follows */
+            if (closed && temaku_peek(s, end)) drop = 2;
+            else if (!closed && last == '%') drop = 1;
+            /* A terminator right at the end of the input is written, but this chunk may not be the end */
+            else if (closed && s == end) drop = 2, last = '}';
+            else if (closed) last = '\0';
+            nwritten += temaku_flush(options, writer, &run);
+            if (deferred && drop > size) {
+                /* The '}' completes the terminator started by the deferred '%' */
+            } else {
+                if (deferred) nwritten += temaku_write(writer, "%", 1);
+                nwritten += temaku_write(writer, start, size - drop);
+            }
+            stream->in_raw = !closed;
+            stream->raw_last = last;
+            continue;
+        }
+        c = *s;
         ++s;
         switch (c) {
         case '=':
-            if (column != 0) goto put;
-            ctx |= CTX_HEADER;
-            TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_HEADER_START, NULL));
+            if (stream->column != 0) goto put;
+            stream->ctx |= CTX_HEADER;
+            TEMAKU_DO_STYLE(TEMAKU_EMIT(TEMAKU_HEADER_START, NULL));
             break;
         case '*':
-            if ((ctx & CTX_BOLD) == 0) {
-                if (in_word) goto put;
-                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_BOLD_START, NULL));
-                ctx |= CTX_BOLD;
-            } else if (!temaku_wordchar(options, s)) {
-                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_BOLD_END, NULL));
-                ctx &= ~CTX_BOLD;
+            if ((stream->ctx & CTX_BOLD) == 0) {
+                if (TEMAKU_IN_WORD()) goto put;
+                TEMAKU_DO_STYLE(TEMAKU_EMIT(TEMAKU_BOLD_START, NULL));
+                stream->ctx |= CTX_BOLD;
+            } else if (!temaku_wordchar(stream, s, end)) {
+                TEMAKU_DO_STYLE(TEMAKU_EMIT(TEMAKU_BOLD_END, NULL));
+                stream->ctx &= ~CTX_BOLD;
             }
             break;
         case '/':
-            if ((ctx & CTX_ITALIC) == 0) {
-                if (in_word) goto put;
-                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_ITALIC_START, NULL));
-                ctx |= CTX_ITALIC;
-            } else if (!temaku_wordchar(options, s)) {
-                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_ITALIC_END, NULL));
-                ctx &= ~CTX_ITALIC;
+            if ((stream->ctx & CTX_ITALIC) == 0) {
+                if (TEMAKU_IN_WORD()) goto put;
+                TEMAKU_DO_STYLE(TEMAKU_EMIT(TEMAKU_ITALIC_START, NULL));
+                stream->ctx |= CTX_ITALIC;
+            } else if (!temaku_wordchar(stream, s, end)) {
+                TEMAKU_DO_STYLE(TEMAKU_EMIT(TEMAKU_ITALIC_END, NULL));
+                stream->ctx &= ~CTX_ITALIC;
             }
             break;
         case '_':
-            if ((ctx & CTX_UNDERLINE) == 0) {
-                if (in_word) goto put;
-                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_UNDERLINE_START, NULL));
-                ctx |= CTX_UNDERLINE;
-            } else if (!temaku_wordchar(options, s)) {
-                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_UNDERLINE_END, NULL));
-                ctx &= ~CTX_UNDERLINE;
+            if ((stream->ctx & CTX_UNDERLINE) == 0) {
+                if (TEMAKU_IN_WORD()) goto put;
+                TEMAKU_DO_STYLE(TEMAKU_EMIT(TEMAKU_UNDERLINE_START, NULL));
+                stream->ctx |= CTX_UNDERLINE;
+            } else if (!temaku_wordchar(stream, s, end)) {
+                TEMAKU_DO_STYLE(TEMAKU_EMIT(TEMAKU_UNDERLINE_END, NULL));
+                stream->ctx &= ~CTX_UNDERLINE;
             }
             break;
         case '|':
-            if ((ctx & CTX_ALTERNATIVE) == 0) {
-                if (in_word) goto put;
-                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_ALTERNATIVE_START, NULL));
-                ctx |= CTX_ALTERNATIVE;
-            } else if (!temaku_wordchar(options, s)) {
-                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_ALTERNATIVE_END, NULL));
-                ctx &= ~CTX_ALTERNATIVE;
+            if ((stream->ctx & CTX_ALTERNATIVE) == 0) {
+                if (TEMAKU_IN_WORD()) goto put;
+                TEMAKU_DO_STYLE(TEMAKU_EMIT(TEMAKU_ALTERNATIVE_START, NULL));
+                stream->ctx |= CTX_ALTERNATIVE;
+            } else if (!temaku_wordchar(stream, s, end)) {
+                TEMAKU_DO_STYLE(TEMAKU_EMIT(TEMAKU_ALTERNATIVE_END, NULL));
+                stream->ctx &= ~CTX_ALTERNATIVE;
             }
             break;
         case '\n':
-            data.base = &c;
-            data.size = 1;
-            temaku_writesequence(options, writer, TEMAKU_DATA, &data);
-            if (ctx & CTX_HEADER)
-                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_HEADER_END, NULL));
-            if (ctx & CTX_BOLD)
-                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_BOLD_END, NULL));
-            if (ctx & CTX_ITALIC)
-                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_ITALIC_END, NULL));
-            if (ctx & CTX_UNDERLINE)
-                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_UNDERLINE_END, NULL));
-            if (ctx & CTX_ALTERNATIVE)
-                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_ALTERNATIVE_END, NULL));
-            if (ctx & CTX_BGLINE)
-                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_BGLINE_END, NULL));
-            ctx = 0;
-            ++row;
-            column = 0;
-            in_word = false;
+            TEMAKU_PUT(seq);
+            if (stream->ctx & CTX_HEADER)
+                TEMAKU_DO_STYLE(TEMAKU_EMIT(TEMAKU_HEADER_END, NULL));
+            if (stream->ctx & CTX_BOLD)
+                TEMAKU_DO_STYLE(TEMAKU_EMIT(TEMAKU_BOLD_END, NULL));
+            if (stream->ctx & CTX_ITALIC)
+                TEMAKU_DO_STYLE(TEMAKU_EMIT(TEMAKU_ITALIC_END, NULL));
+            if (stream->ctx & CTX_UNDERLINE)
+                TEMAKU_DO_STYLE(TEMAKU_EMIT(TEMAKU_UNDERLINE_END, NULL));
+            if (stream->ctx & CTX_ALTERNATIVE)
+                TEMAKU_DO_STYLE(TEMAKU_EMIT(TEMAKU_ALTERNATIVE_END, NULL));
+            if (stream->ctx & CTX_BGLINE)
+                TEMAKU_DO_COLOR(TEMAKU_EMIT(TEMAKU_BGLINE_END, NULL));
+            stream->ctx = 0;
+            ++stream->row;
+            stream->column = 0;
+            stream->in_word = false;
+            word.base = NULL;
             break;
         case '%':
-            c = *s;
-            s += !!*s;
+            c = temaku_peek(s, end);
+            s += !!c;
             switch (c) {
             case '\0': break;
             case '{':
-                {
-                    const char *start = s;
-                    while (*s && (s[-1] != '}' || s[-2] != '%')) ++s;
-                    int size = s - start - (*s?2:0);
-                    temaku_write(writer, start, size);
-                }
+                stream->in_raw = true;
+                stream->raw_last = '{';
                 break;
             case 'F':
             case 'K':
-                if (*s != '{') break;
+                if (temaku_peek(s, end) != '{') break;
                 ++s;
                 const char *start = s;
-                while (*s && *s != '}') ++s;
+                while (temaku_peek(s, end) && *s != '}') ++s;
                 int size = s - start;
+                /* Only names that start with the same letter can match, so skip comparing the rest */
+                char first = size ? tolower((unsigned char)*start) : '\0';
                 TEMAKU_DO_COLOR({
-                    if (strequalni("reset", start, size)) {
+                    if ((!size || first == 'r') && strequalni("reset", start, size)) {
                         if (c == 'F') {
-                            TEMAKU_DO_COLOR(temaku_writesequence(options, writer, TEMAKU_FGCOLOR_END, &fgcolor));
-                            fgcolor = -1;
+                            TEMAKU_DO_COLOR(TEMAKU_EMIT(TEMAKU_FGCOLOR_END, &stream->fgcolor));
+                            stream->fgcolor = -1;
                         } else {
-                            TEMAKU_DO_COLOR(temaku_writesequence(options, writer, TEMAKU_BGCOLOR_END, &bgcolor));
-                            bgcolor = -1;
+                            TEMAKU_DO_COLOR(TEMAKU_EMIT(TEMAKU_BGCOLOR_END, &stream->bgcolor));
+                            stream->bgcolor = -1;
                         }
                     } else for (int j=0; color_names[j]; j++) {
+                        if (size && color_names[j][0] != first) continue;
                         if (strequaln(color_names[j], start, size)) {
                             if (c == 'F') {
-                                fgcolor = j;
-                                TEMAKU_DO_COLOR(temaku_writesequence(options, writer, TEMAKU_FGCOLOR_START, &fgcolor));
+                                stream->fgcolor = j;
+                                TEMAKU_DO_COLOR(TEMAKU_EMIT(TEMAKU_FGCOLOR_START, &stream->fgcolor));
                             } else {
-                                bgcolor = j;
-                                TEMAKU_DO_COLOR(temaku_writesequence(options, writer, TEMAKU_BGCOLOR_START, &fgcolor));
+                                stream->bgcolor = j;
+                                TEMAKU_DO_COLOR(TEMAKU_EMIT(TEMAKU_BGCOLOR_START, &stream->fgcolor));
                             }
                             break;
                         } else if (strequalni(color_names[j], start, size)) {
                             /* Color name contains at least one uppercase letter */
                             if (c == 'F') {
-                                fgcolor = j + 8; /* Use bright colors */
-                                TEMAKU_DO_COLOR(temaku_writesequence(options, writer, TEMAKU_FGCOLOR_START, &fgcolor));
+                                stream->fgcolor = j + 8; /* Use bright colors */
+                                TEMAKU_DO_COLOR(TEMAKU_EMIT(TEMAKU_FGCOLOR_START, &stream->fgcolor));
                             } else {
-                                bgcolor = j + 8; /* Use bright colors */
-                                TEMAKU_DO_COLOR(temaku_writesequence(options, writer, TEMAKU_BGCOLOR_START, &fgcolor));
+                                stream->bgcolor = j + 8; /* Use bright colors */
+                                TEMAKU_DO_COLOR(TEMAKU_EMIT(TEMAKU_BGCOLOR_START, &stream->fgcolor));
                             }
                             break;
                         }
                     }
                 });
-                s += !!*s;
+                s += !!temaku_peek(s, end);
                 break;
             case 'f':
-                TEMAKU_DO_COLOR(temaku_writesequence(options, writer, TEMAKU_FGCOLOR_END, &fgcolor));
-                fgcolor = -1;
+                TEMAKU_DO_COLOR(TEMAKU_EMIT(TEMAKU_FGCOLOR_END, &stream->fgcolor));
+                stream->fgcolor = -1;
                 break;
             case 'k':
-                TEMAKU_DO_COLOR(temaku_writesequence(options, writer, TEMAKU_BGCOLOR_END, &bgcolor));
-                bgcolor = -1;
+                TEMAKU_DO_COLOR(TEMAKU_EMIT(TEMAKU_BGCOLOR_END, &stream->bgcolor));
+                stream->bgcolor = -1;
                 break;
             case 'L':
-                if (*s != '{') break;
+                if (temaku_peek(s, end) != '{') break;
+                ++s;
+                data.base = s;
+                while (temaku_peek(s, end) && *s != '}') ++s;
+                data.size = s - data.base;
+                TEMAKU_DO_LINKS(TEMAKU_EMIT(TEMAKU_LINK_START, &data));
+                s += !!temaku_peek(s, end);
+                break;
+            case 'P':
+                if (temaku_peek(s, end) != '{') break;
                 ++s;
                 data.base = s;
-                while (*s && *s != '}') ++s;
+                while (temaku_peek(s, end) && *s != '}') ++s;
                 data.size = s - data.base;
-                TEMAKU_DO_LINKS(temaku_writesequence(options, writer, TEMAKU_LINK_START, &data));
-                s += !!*s;
+                if (stream->resolver) {
+                    /* Parameters are text, not markup, so they are written regardless of do_markup */
+                    nwritten += temaku_flush(options, writer, &run);
+                    nwritten += (*stream->resolver)((TEMAKU_SELF *)stream->resolver, options, writer, data.base, data.size);
+                }
+                s += !!temaku_peek(s, end);
                 break;
             case 'l':
-                TEMAKU_DO_LINKS(temaku_writesequence(options, writer, TEMAKU_LINK_END, NULL));
+                TEMAKU_DO_LINKS(TEMAKU_EMIT(TEMAKU_LINK_END, NULL));
                 break;
             case 'B':
-                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_BOLD_START, NULL));
+                TEMAKU_DO_STYLE(TEMAKU_EMIT(TEMAKU_BOLD_START, NULL));
                 break;
             case 'b':
-                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_BOLD_END, NULL));
+                TEMAKU_DO_STYLE(TEMAKU_EMIT(TEMAKU_BOLD_END, NULL));
                 break;
             case 'I':
-                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_ITALIC_START, NULL));
+                TEMAKU_DO_STYLE(TEMAKU_EMIT(TEMAKU_ITALIC_START, NULL));
                 break;
             case 'i':
-                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_ITALIC_END, NULL));
+                TEMAKU_DO_STYLE(TEMAKU_EMIT(TEMAKU_ITALIC_END, NULL));
                 break;
             case 'U':
-                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_UNDERLINE_START, NULL));
+                TEMAKU_DO_STYLE(TEMAKU_EMIT(TEMAKU_UNDERLINE_START, NULL));
                 break;
             case 'u':
-                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_UNDERLINE_END, NULL));
+                TEMAKU_DO_STYLE(TEMAKU_EMIT(TEMAKU_UNDERLINE_END, NULL));
                 break;
             case 'S':
-                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_STRIKETHROUGH_START, NULL));
+                TEMAKU_DO_STYLE(TEMAKU_EMIT(TEMAKU_STRIKETHROUGH_START, NULL));
                 break;
             case 's':
-                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_STRIKETHROUGH_END, NULL));
+                TEMAKU_DO_STYLE(TEMAKU_EMIT(TEMAKU_STRIKETHROUGH_END, NULL));
                 break;
             case 'R':
-                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_REVERSE_VIDEO_START, NULL));
+                TEMAKU_DO_STYLE(TEMAKU_EMIT(TEMAKU_REVERSE_VIDEO_START, NULL));
                 break;
             case 'r':
-                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_REVERSE_VIDEO_END, NULL));
+                TEMAKU_DO_STYLE(TEMAKU_EMIT(TEMAKU_REVERSE_VIDEO_END, NULL));
                 break;
             case 'A':
-                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_ALTERNATIVE_START, NULL));
+                TEMAKU_DO_STYLE(TEMAKU_EMIT(TEMAKU_ALTERNATIVE_START, NULL));
                 break;
             case 'a':
-                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_ALTERNATIVE_END, NULL));
+                TEMAKU_DO_STYLE(TEMAKU_EMIT(TEMAKU_ALTERNATIVE_END, NULL));
                 break;
             case 'E':
-                TEMAKU_DO_COLOR(temaku_writesequence(options, writer, TEMAKU_BGLINE_START, &bgcolor));
-                ctx |= CTX_BGLINE;
+                TEMAKU_DO_COLOR(TEMAKU_EMIT(TEMAKU_BGLINE_START, &stream->bgcolor));
+                stream->ctx |= CTX_BGLINE;
                 break;
             default:
-                in_word = temaku_wordchar(options, seq);
-                data.base = &c;
-                data.size = 1;
-                temaku_writesequence(options, writer, TEMAKU_DATA, &data);
-                ++column;
+                stream->in_word = temaku_wordchar(stream, seq, end);
+                word.base = NULL;
+                TEMAKU_PUT(s - 1);
+                if ((unsigned char)c >= 0x80) {
+                    /* Write the rest of a UTF-8 character too */
+                    size_t size = temaku_utf8_char((const unsigned char *)s - 1, end - s + 1);
+                    for (; size > 1; size--, s++) TEMAKU_PUT(s);
+                }
+                ++stream->column;
                 break;
             }
             break;
-default:
+        default:
+            /* Bulk run of plain text, in the same switch as the markup so that dense markup costs one branch per character */
+            s = temaku_scan(s, limit);
+            /* Don't stop in the middle of a UTF-8 character because of the limit, it may be a word character */
+            while (s == limit && s < end && ((unsigned char)*s & 0xc0) == 0x80) limit = ++s;
+            if (run.base + run.size != seq) {
+                nwritten += temaku_flush(options, writer, &run);
+                run.base = seq;
+            }
+            run.size += s - seq;
+            stream->column += s - seq;
+            /* Plain text never contains '%' or NUL, so temaku_wordchar_last will do */
+            word.base = seq;
+            word.size = s - seq;
+            break;
 put:
-            in_word = temaku_wordchar(options, seq);
-            data.base = &c;
-            data.size = 1;
-            temaku_writesequence(options, writer, TEMAKU_DATA, &data);
-            ++column;
+            stream->in_word = temaku_wordchar(stream, seq, end);
+            word.base = NULL;
+            TEMAKU_PUT(seq);
+            ++stream->column;
             break;
         }
     }
-    if (ctx & CTX_HEADER)
-        TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_HEADER_END, NULL));
-    if (ctx & CTX_BOLD)
-        TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_BOLD_END, NULL));
-    if (ctx & CTX_ITALIC)
-        TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_ITALIC_END, NULL));
-    if (ctx & CTX_UNDERLINE)
-        TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_UNDERLINE_END, NULL));
-    if (ctx & CTX_ALTERNATIVE)
-        TEMAKU_DO_COLOR(temaku_writesequence(options, writer, TEMAKU_ALTERNATIVE_END, NULL));
-    if (ctx & CTX_BGLINE)
-        TEMAKU_DO_COLOR(temaku_writesequence(options, writer, TEMAKU_BGLINE_END, NULL));
-    data.base = markup;
-    data.size = markuplen;
-    temaku_writesequence(options, writer, TEMAKU_END, &data);
-    return 0;
+    nwritten += temaku_flush(options, writer, &run);
+    TEMAKU_IN_WORD();
+    *stop = s;
+    return nwritten;
+#undef TEMAKU_PUT
+#undef TEMAKU_EMIT
+#undef TEMAKU_IN_WORD
+}
+TEMAKU_FUN(int) temaku_stream_write(struct temaku_stream *stream, const char *markup, size_t markuplen)
+{
+    const char *stop;
+    return temaku_stream_feed(stream, markup, markup + markuplen, markup + markuplen, &stop);
+}
+TEMAKU_FUN(int) temaku_stream_writedata(struct temaku_stream *stream, const char *data, size_t size)
+{
+    if (size == 0) return 0;
+    stream->in_word = false;
+    stream->column += size;
+    return temaku_writedata(stream->options, stream->writer, data, size);
+}
+TEMAKU_FUN(int) temaku_stream_end(struct temaku_stream *stream)
+{
+    struct temaku_string text = { "", 0 };
+    return temaku_stream_finish(stream, &text);
+}
+TEMAKU_FUN(int) temaku_markup_params(struct temaku_options *options, temaku_writer_t *writer, const char *markup, size_t markuplen, temaku_param_resolver_t *resolver)
+{
+    struct temaku_stream stream;
+    struct temaku_string text;
+    int nwritten = 0;
+    if (markuplen == 0 || markuplen == SIZE_MAX) {
+        markuplen = strlen(markup);
+    }
+    text.base = markup;
+    text.size = markuplen;
+    nwritten += temaku_stream_start(&stream, options, writer, &text);
+    stream.resolver = resolver;
+    nwritten += temaku_stream_write(&stream, markup, markuplen);
+    nwritten += temaku_stream_finish(&stream, &text);
+    return nwritten;
+}
+TEMAKU_FUN(int) temaku_markup(struct temaku_options *options, temaku_writer_t *writer, const char *markup, size_t markuplen)
+{
+    return temaku_markup_params(options, writer, markup, markuplen, NULL);
+}
+
 #undef TEMAKU_DO_LINKS
 #undef TEMAKU_DO_STYLE
 #undef TEMAKU_DO_COLOR
+
+TEMAKU_FUN(int) temaku_count_writer_cb(TEMAKU_SELF *self, const void *data, size_t size)
+{
+    temaku_count_writer_t *writer = (temaku_count_writer_t *)self;
+    (void)data;
+    writer->count += size;
+    return size;
+}
+TEMAKU_FUN(int) temaku_buffer_writer_cb(TEMAKU_SELF *self, const void *data, size_t size)
+{
+    temaku_buffer_writer_t *writer = (temaku_buffer_writer_t *)self;
+    if (writer->size < writer->capacity) {
+        size_t avail = writer->capacity - writer->size;
+        memcpy(writer->base + writer->size, data, size < avail ? size : avail);
+    }
+    writer->size += size;
+    return size;
+}
+
+TEMAKU_FUN(temaku_count_writer_t) temaku_count_writer_new(void)
+{
+    temaku_count_writer_t writer;
+    writer.writer = temaku_count_writer_cb;
+    writer.count = 0;
+    return writer;
+}
+TEMAKU_FUN(temaku_buffer_writer_t) temaku_buffer_writer_new(char *buf, size_t cap)
+{
+    temaku_buffer_writer_t writer;
+    writer.writer = temaku_buffer_writer_cb;
+    writer.base = buf;
+    writer.capacity = cap;
+    writer.size = 0;
+    return writer;
+}
+
+TEMAKU_FUN(size_t) temaku_measure(struct temaku_options *options, const char *markup, size_t markuplen)
+{
+    temaku_count_writer_t writer = temaku_count_writer_new();
+    temaku_markup(options, &writer.writer, markup, markuplen);
+    return writer.count;
+}
+TEMAKU_FUN(size_t) temaku_markup_to_buffer(struct temaku_options *options, char *buf, size_t cap, const char *markup, size_t markuplen)
+{
+    /* Reserve the last byte of the buffer for the NUL terminator */
+    temaku_buffer_writer_t writer = temaku_buffer_writer_new(buf, cap ? cap - 1 : 0);
+    temaku_markup(options, &writer.writer, markup, markuplen);
+    if (cap) buf[writer.size < cap ? writer.size : cap - 1] = '\0';
+    return writer.size;
+}
+
+enum {
+    CELL_BOLD          = 0x1,
+    CELL_DIM           = 0x2,
+    CELL_ITALIC        = 0x4,
+    CELL_UNDERLINE     = 0x8,
+    CELL_REVERSE       = 0x10,
+    CELL_STRIKETHROUGH = 0x20,
+};
+
+/* Output buffer, so that a redraw doesn't cost a writer call for every cell */
+struct temaku_outbuf {
+    temaku_writer_t *writer;
+    int nwritten;
+    size_t size;
+    char buffer[512];
+};
+
+static void temaku_outbuf_flush(struct temaku_outbuf *out)
+{
+    if (out->size) out->nwritten += temaku_write(out->writer, out->buffer, out->size);
+    out->size = 0;
+}
+static void temaku_outbuf_write(struct temaku_outbuf *out, const char *data, size_t size)
+{
+    if (size > sizeof(out->buffer) - out->size) {
+        temaku_outbuf_flush(out);
+        if (size > sizeof(out->buffer)) {
+            out->nwritten += temaku_write(out->writer, data, size);
+            return;
+        }
+    }
+    memcpy(out->buffer + out->size, data, size);
+    out->size += size;
+}
+static void temaku_outbuf_writestr(struct temaku_outbuf *out, const char *str)
+{
+    temaku_outbuf_write(out, str, strlen(str));
+}
+static void temaku_outbuf_writeint(struct temaku_outbuf *out, unsigned val)
+{
+    char buffer[16];
+    size_t i = sizeof(buffer);
+    do buffer[--i] = '0' + val % 10; while (val /= 10);
+    temaku_outbuf_write(out, buffer + i, sizeof(buffer) - i);
+}
+
+static bool temaku_reserve(void **base, size_t *capacity, size_t size, size_t elemsize)
+{
+    size_t newcapacity = *capacity ? *capacity : 16;
+    void *newbase;
+    if (size <= *capacity) return true;
+    while (newcapacity < size) newcapacity *= 2;
+    newbase = realloc(*base, newcapacity * elemsize);
+    if (!newbase) return false;
+    *base = newbase;
+    *capacity = newcapacity;
+    return true;
+}
+static void temaku_screen_newline(temaku_screen_t *screen)
+{
+    temaku_frame_t *frame = &screen->frames[!screen->current];
+    if (!temaku_reserve((void **)&frame->lines, &frame->lines_capacity, frame->nlines + 1, sizeof(temaku_line_t))) {
+        screen->failed = true;
+        return;
+    }
+    frame->lines[frame->nlines].start = frame->ncells;
+    frame->lines[frame->nlines].size = 0;
+    frame->lines[frame->nlines].fill = -2;
+    frame->nlines++;
+}
+static void temaku_screen_putcell(temaku_screen_t *screen, const temaku_cell_t *cell)
+{
+    temaku_frame_t *frame = &screen->frames[!screen->current];
+    if (screen->failed || !frame->nlines) return;
+    if (!temaku_reserve((void **)&frame->cells, &frame->cells_capacity, frame->ncells + 1, sizeof(temaku_cell_t))) {
+        screen->failed = true;
+        return;
+    }
+    frame->cells[frame->ncells++] = *cell;
+    frame->lines[frame->nlines - 1].size++;
+}
+/* Render the text in @{data} into cells */
+static void temaku_screen_puttext(temaku_screen_t *screen, const void *data, size_t size)
+{
+    temaku_frame_t *frame = &screen->frames[!screen->current];
+    const unsigned char *s = (const unsigned char *)data;
+    for (size_t i=0; i < size; i++) {
+        unsigned char c = s[i];
+        if (c == '\n') {
+            temaku_screen_newline(screen);
+        } else if (c == '\t') {
+            temaku_cell_t cell = screen->pen;
+            cell.ch[0] = ' ';
+            cell.size = 1;
+            do temaku_screen_putcell(screen, &cell);
+            while (!screen->failed && frame->lines[frame->nlines - 1].size % 8);
+        } else if (c < 0x20 || c == 0x7f) {
+            /* Control characters would mess up our idea of where the cursor is */
+        } else if ((c & 0xc0) == 0x80 && frame->nlines && frame->lines[frame->nlines - 1].size &&
+                   frame->cells[frame->ncells - 1].size < 4 && (frame->cells[frame->ncells - 1].ch[0] & 0xc0) == 0xc0) {
+            /* UTF-8 continuation byte */
+            temaku_cell_t *cell = &frame->cells[frame->ncells - 1];
+            cell->ch[cell->size++] = c;
+        } else {
+            temaku_cell_t cell = screen->pen;
+            cell.ch[0] = c;
+            cell.size = 1;
+            temaku_screen_putcell(screen, &cell);
+        }
+    }
+}
+/* Text comes through temaku_screen_sequence_cb, so everything written here is from a %{ ... %} block */
+static int temaku_screen_capture_cb(TEMAKU_SELF *self, const void *data, size_t size)
+{
+    temaku_screen_t *screen = ((struct temaku_screen_capture *)self)->screen;
+    temaku_frame_t *frame = &screen->frames[!screen->current];
+    if (screen->failed) return size;
+    if (!temaku_reserve((void **)&frame->raw, &frame->raw_capacity, frame->nraw + size, 1)) {
+        screen->failed = true;
+        return size;
+    }
+    memcpy(frame->raw + frame->nraw, data, size);
+    frame->nraw += size;
+    return size;
+}
+static int temaku_screen_sequence_cb(TEMAKU_SELF *self, struct temaku_options *options, temaku_writer_t *writer, enum temaku_sequence seq, void *arg)
+{
+    temaku_screen_t *screen = (temaku_screen_t *)self;
+    temaku_cell_t *pen = &screen->pen;
+    temaku_frame_t *frame = &screen->frames[!screen->current];
+    (void)options;
+    /* Mirrors what temaku_write_ansi_sequence_cb does to the terminal state */
+    switch (seq) {
+    case TEMAKU_START: break;
+    case TEMAKU_END: break;
+    case TEMAKU_DATA:
+        {
+            struct temaku_string *data = (struct temaku_string *)arg;
+            (void)writer;
+            temaku_screen_puttext(screen, data->base, data->size);
+            return data->size;
+        }
+    case TEMAKU_HEADER_START: pen->attr |= CELL_BOLD | CELL_UNDERLINE; break;
+    case TEMAKU_HEADER_END: pen->attr &= ~(CELL_BOLD | CELL_DIM | CELL_UNDERLINE); break;
+    case TEMAKU_BOLD_START: pen->attr |= CELL_BOLD; break;
+    case TEMAKU_BOLD_END: pen->attr &= ~(CELL_BOLD | CELL_DIM); break;
+    case TEMAKU_ITALIC_START: pen->attr |= CELL_ITALIC; break;
+    case TEMAKU_ITALIC_END: pen->attr &= ~CELL_ITALIC; break;
+    case TEMAKU_UNDERLINE_START: pen->attr |= CELL_UNDERLINE; break;
+    case TEMAKU_UNDERLINE_END: pen->attr &= ~CELL_UNDERLINE; break;
+    case TEMAKU_STRIKETHROUGH_START: pen->attr |= CELL_STRIKETHROUGH; break;
+    case TEMAKU_STRIKETHROUGH_END: pen->attr &= ~CELL_STRIKETHROUGH; break;
+    case TEMAKU_REVERSE_VIDEO_START: pen->attr |= CELL_REVERSE; break;
+    case TEMAKU_REVERSE_VIDEO_END: pen->attr &= ~CELL_REVERSE; break;
+    case TEMAKU_ALTERNATIVE_START: pen->attr |= CELL_DIM; break;
+    case TEMAKU_ALTERNATIVE_END: pen->attr &= ~(CELL_BOLD | CELL_DIM); break;
+    case TEMAKU_FGCOLOR_START: if (*(int *)arg != -1) pen->fg = *(int *)arg % 16; break;
+    case TEMAKU_FGCOLOR_END: pen->fg = -1; break;
+    case TEMAKU_BGCOLOR_START: if (*(int *)arg != -1) pen->bg = *(int *)arg % 16; break;
+    case TEMAKU_BGCOLOR_END: pen->bg = -1; break;
+    case TEMAKU_BGLINE_START:
+        if (frame->nlines) frame->lines[frame->nlines - 1].fill = pen->bg;
+        break;
+    case TEMAKU_BGLINE_END: break;
+    case TEMAKU_LINK_START: break;
+    case TEMAKU_LINK_END: break;
+    }
+    return 0;
+}
+
+/* Write the SGR sequence to go from the attributes of @{from} to those of @{to} */
+static void temaku_screen_sgr(struct temaku_outbuf *out, temaku_cell_t *from, const temaku_cell_t *to)
+{
+    static const struct { unsigned char attr; const char *sgr; } attrs[] = {
+        { CELL_BOLD, ";1" },
+        { CELL_DIM, ";2" },
+        { CELL_ITALIC, ";3" },
+        { CELL_UNDERLINE, ";4" },
+        { CELL_REVERSE, ";7" },
+        { CELL_STRIKETHROUGH, ";9" },
+    };
+    if (from->attr == to->attr && from->fg == to->fg && from->bg == to->bg) return;
+    temaku_outbuf_writestr(out, "\x1b[0");
+    for (size_t i=0; i < sizeof(attrs) / sizeof(attrs[0]); i++) {
+        if (to->attr & attrs[i].attr) temaku_outbuf_writestr(out, attrs[i].sgr);
+    }
+    if (to->fg >= 0) {
+        temaku_outbuf_writestr(out, ";");
+        temaku_outbuf_writeint(out, to->fg < 8 ? 30 + to->fg : 90 + to->fg - 8);
+    }
+    if (to->bg >= 0) {
+        temaku_outbuf_writestr(out, ";");
+        temaku_outbuf_writeint(out, to->bg < 8 ? 40 + to->bg : 100 + to->bg - 8);
+    }
+    temaku_outbuf_writestr(out, "m");
+    from->attr = to->attr;
+    from->fg = to->fg;
+    from->bg = to->bg;
+}
+/* Move the cursor from (@{*row}, @{*col}) to (@{row}, @{col}) */
+static void temaku_screen_move(struct temaku_outbuf *out, temaku_cell_t *sgr, size_t *cur_row, size_t *cur_col, size_t row, size_t col)
+{
+    static const temaku_cell_t reset = { { 0 }, 0, 0, -1, -1 };
+    if (row < *cur_row) {
+        temaku_outbuf_writestr(out, "\x1b[");
+        temaku_outbuf_writeint(out, *cur_row - row);
+        temaku_outbuf_writestr(out, "A");
+    } else if (row > *cur_row) {
+        /* Newlines scroll if needed, unlike cursor movement; don't let them paint the background */
+        temaku_screen_sgr(out, sgr, &reset);
+        for (size_t i=*cur_row; i < row; i++) temaku_outbuf_writestr(out, "\n");
+        *cur_col = SIZE_MAX;
+    }
+    if (col != *cur_col) {
+        if (col == 0) {
+            temaku_outbuf_writestr(out, "\r");
+        } else {
+            temaku_outbuf_writestr(out, "\x1b[");
+            temaku_outbuf_writeint(out, col + 1);
+            temaku_outbuf_writestr(out, "G");
+        }
+    }
+    *cur_row = row;
+    *cur_col = col;
+}
+
+TEMAKU_FUN(void) temaku_screen_init(temaku_screen_t *screen)
+{
+    memset(screen, 0, sizeof(*screen));
+    screen->sequence_writer = temaku_screen_sequence_cb;
+    screen->capture.writer = temaku_screen_capture_cb;
+    screen->capture.screen = screen;
+}
+TEMAKU_FUN(void) temaku_screen_free(temaku_screen_t *screen)
+{
+    for (int i=0; i < 2; i++) {
+        free(screen->frames[i].cells);
+        free(screen->frames[i].lines);
+        free(screen->frames[i].raw);
+    }
+    temaku_screen_init(screen);
+}
+TEMAKU_FUN(void) temaku_screen_invalidate(temaku_screen_t *screen)
+{
+    temaku_frame_t *frame = &screen->frames[screen->current];
+    /* Keep the line count, so we still know where the cursor is */
+    frame->ncells = 0;
+    frame->nraw = 0;
+    for (size_t i=0; i < frame->nlines; i++) {
+        frame->lines[i].start = 0;
+        frame->lines[i].size = 0;
+        frame->lines[i].fill = -3; /* Unknown, so that the line always gets cleared */
+    }
+}
+TEMAKU_FUN(int) temaku_screen_update(temaku_screen_t *screen, struct temaku_options *options, temaku_writer_t *writer, const char *markup, size_t markuplen)
+{
+    static const temaku_cell_t reset = { { 0 }, 0, 0, -1, -1 };
+    struct temaku_options capture_options;
+    temaku_frame_t *prev, *next;
+    temaku_cell_t sgr = reset;
+    struct temaku_outbuf out;
+    size_t cur_row, cur_col = 0, nlines;
+    if (options == NULL) options = &temaku_default_options;
+    capture_options = *options;
+    capture_options.sequence_writer = &screen->sequence_writer;
+    /* Render into the frame that is not on the screen */
+    screen->capture.screen = screen;
+    next = &screen->frames[!screen->current];
+    next->ncells = 0;
+    next->nlines = 0;
+    next->nraw = 0;
+    screen->failed = false;
+    screen->pen = reset;
+    temaku_screen_newline(screen);
+    temaku_markup(&capture_options, &screen->capture.writer, markup, markuplen);
+    if (screen->failed) return -1;
+    prev = &screen->frames[screen->current];
+    if (!screen->drawn) prev->nlines = 0, prev->nraw = 0;
+    out.writer = writer;
+    out.nwritten = 0;
+    out.size = 0;
+    /* The %{ ... %} blocks take up no room, so they can go out before any cursor movement */
+    if (next->nraw && (next->nraw != prev->nraw || memcmp(next->raw, prev->raw, next->nraw) != 0)) temaku_outbuf_write(&out, next->raw, next->nraw);
+    /* The cursor was left at the start of the last line of the previous frame */
+    cur_row = prev->nlines ? prev->nlines - 1 : 0;
+    nlines = next->nlines > prev->nlines ? next->nlines : prev->nlines;
+    for (size_t row=0; row < nlines; row++) {
+        const temaku_line_t *oldline = row < prev->nlines ? &prev->lines[row] : NULL;
+        const temaku_line_t *newline = row < next->nlines ? &next->lines[row] : NULL;
+        const temaku_cell_t *oldcells = oldline ? prev->cells + oldline->start : NULL;
+        const temaku_cell_t *newcells = newline ? next->cells + newline->start : NULL;
+        size_t oldsize = oldline ? oldline->size : 0;
+        size_t newsize = newline ? newline->size : 0;
+        int oldfill = oldline ? oldline->fill : -2;
+        int newfill = newline ? newline->fill : -2;
+        size_t col = 0;
+        while (col < newsize) {
+            size_t start, end, gap;
+            /* Find the next span of changed cells, allowing small gaps that are cheaper to redraw than to skip */
+            while (col < newsize && col < oldsize && memcmp(&newcells[col], &oldcells[col], sizeof(temaku_cell_t)) == 0) col++;
+            if (col == newsize) break;
+            start = end = col;
+            for (gap = 0; col < newsize && gap < 4; col++) {
+                if (col >= oldsize || memcmp(&newcells[col], &oldcells[col], sizeof(temaku_cell_t)) != 0) {
+                    end = col + 1;
+                    gap = 0;
+                } else {
+                    gap++;
+                }
+            }
+            col = end;
+            temaku_screen_move(&out, &sgr, &cur_row, &cur_col, row, start);
+            for (size_t i=start; i < end; i++) {
+                temaku_screen_sgr(&out, &sgr, &newcells[i]);
+                temaku_outbuf_write(&out, newcells[i].ch, newcells[i].size);
+            }
+            cur_col = end;
+        }
+        if (newsize < oldsize || newfill != oldfill) {
+            /* Clear the rest of the line, with the fill color from %E if any */
+            temaku_cell_t fill = reset;
+            fill.bg = newfill >= 0 ? newfill : -1;
+            temaku_screen_move(&out, &sgr, &cur_row, &cur_col, row, newsize);
+            temaku_screen_sgr(&out, &sgr, &fill);
+            temaku_outbuf_writestr(&out, "\x1b[K");
+        }
+    }
+    temaku_screen_sgr(&out, &sgr, &reset);
+    temaku_screen_move(&out, &sgr, &cur_row, &cur_col, next->nlines - 1, 0);
+    temaku_outbuf_flush(&out);
+    screen->current = !screen->current;
+    screen->drawn = true;
+    return out.nwritten;
+}
+
+/* Return whether @{options} allows writing sequence @{seq}, the same way temaku_markup decides */
+static bool temaku_allowed(struct temaku_options *options, enum temaku_sequence seq)
+{
+    switch (seq) {
+    case TEMAKU_START:
+    case TEMAKU_END:
+    case TEMAKU_DATA:
+        return true;
+    case TEMAKU_FGCOLOR_START:
+    case TEMAKU_FGCOLOR_END:
+    case TEMAKU_BGCOLOR_START:
+    case TEMAKU_BGCOLOR_END:
+    case TEMAKU_BGLINE_START:
+    case TEMAKU_BGLINE_END:
+        return options->do_markup && options->do_color;
+    case TEMAKU_LINK_START:
+    case TEMAKU_LINK_END:
+        return options->do_markup && options->do_links;
+    default:
+        return options->do_markup && options->do_style;
+    }
+}
+static int temaku_fanout_sequence_cb(TEMAKU_SELF *self, struct temaku_options *options, temaku_writer_t *writer, enum temaku_sequence seq, void *arg)
+{
+    temaku_fanout_t *fanout = (temaku_fanout_t *)self;
+    int nwritten = 0;
+    (void)options;
+    (void)writer;
+    for (size_t i=0; i < fanout->ntargets; i++) {
+        temaku_target_t *target = &fanout->targets[i];
+        struct temaku_options *target_options = target->options ? target->options : &temaku_default_options;
+        /* Targets usually want everything, and then there is no need to look at the sequence */
+        bool everything = target_options->do_markup && target_options->do_color && target_options->do_style && target_options->do_links;
+        if (everything || temaku_allowed(target_options, seq)) {
+            nwritten += temaku_writesequence(target_options, target->writer, seq, arg);
+        }
+    }
+    return nwritten;
+}
+static int temaku_fanout_writer_cb(TEMAKU_SELF *self, const void *data, size_t size)
+{
+    temaku_fanout_t *fanout = ((struct temaku_fanout_writer *)self)->fanout;
+    int nwritten = 0;
+    for (size_t i=0; i < fanout->ntargets; i++) {
+        nwritten += temaku_write(fanout->targets[i].writer, data, size);
+    }
+    return nwritten;
+}
+
+TEMAKU_FUN(void) temaku_fanout_init(temaku_fanout_t *fanout, temaku_target_t *targets, size_t ntargets)
+{
+    fanout->sequence_writer = temaku_fanout_sequence_cb;
+    fanout->writer.writer = temaku_fanout_writer_cb;
+    fanout->writer.fanout = fanout;
+    fanout->options = ntargets && targets[0].options ? *targets[0].options : temaku_default_options;
+    fanout->options.sequence_writer = &fanout->sequence_writer;
+    fanout->options.do_markup = true;
+    fanout->options.do_color = true;
+    fanout->options.do_style = true;
+    fanout->options.do_links = true;
+    fanout->targets = targets;
+    fanout->ntargets = ntargets;
+}
+TEMAKU_FUN(int) temaku_markup_fanout(temaku_target_t *targets, size_t ntargets, const char *markup, size_t markuplen)
+{
+    temaku_fanout_t fanout;
+    temaku_fanout_init(&fanout, targets, ntargets);
+    return temaku_markup(&fanout.options, &fanout.writer.writer, markup, markuplen);
+}
+
+static int temaku_params_cb(TEMAKU_SELF *self, struct temaku_options *options, temaku_writer_t *writer, const char *name, size_t size)
+{
+    temaku_params_t *params = (temaku_params_t *)self;
+    const temaku_param_t *param = NULL;
+    size_t index = 0, i;
+    for (i=0; i < size && isdigit((unsigned char)name[i]); i++) index = index * 10 + (name[i] - '0');
+    if (size && i == size) {
+        /* Positional parameter, counting from 1 */
+        if (index >= 1 && index <= params->nparams) param = &params->params[index - 1];
+    } else {
+        for (i=0; i < params->nparams; i++) {
+            const char *other = params->params[i].name;
+            if (other && strlen(other) == size && memcmp(other, name, size) == 0) {
+                param = &params->params[i];
+                break;
+            }
+        }
+    }
+    if (!param) return 0;
+    if (param->str) return temaku_writedata(options, writer, param->str, param->size);
+    return temaku_writedataint(options, writer, param->integer);
+}
+TEMAKU_FUN(temaku_params_t) temaku_params_new(const temaku_param_t *params, size_t nparams)
+{
+    temaku_params_t resolver;
+    resolver.resolver = temaku_params_cb;
+    resolver.params = params;
+    resolver.nparams = nparams;
+    return resolver;
+}
+
+/* Record operation @{op}, whose offset and size already refer to the strings of @{tmpl} */
+static void temaku_template_push(temaku_template_t *tmpl, temaku_template_op_t op)
+{
+    if (tmpl->failed) return;
+    if (!temaku_reserve((void **)&tmpl->ops, &tmpl->ops_capacity, tmpl->nops + 1, sizeof(temaku_template_op_t))) {
+        tmpl->failed = true;
+        return;
+    }
+    tmpl->ops[tmpl->nops++] = op;
+}
+/* Copy @{size} bytes of @{data} into the strings of @{tmpl} and record operation @{op} referring to them */
+static void temaku_template_record(temaku_template_t *tmpl, temaku_template_op_t op, const char *data, size_t size)
+{
+    if (tmpl->failed) return;
+    if (!temaku_reserve((void **)&tmpl->strings, &tmpl->strings_capacity, tmpl->nstrings + size, 1)) {
+        tmpl->failed = true;
+        return;
+    }
+    if (size) memcpy(tmpl->strings + tmpl->nstrings, data, size);
+    op.offset = tmpl->nstrings;
+    op.size = size;
+    tmpl->nstrings += size;
+    temaku_template_push(tmpl, op);
+}
+static int temaku_template_sequence_cb(TEMAKU_SELF *self, struct temaku_options *options, temaku_writer_t *writer, enum temaku_sequence seq, void *arg)
+{
+    temaku_template_t *tmpl = (temaku_template_t *)self;
+    temaku_template_op_t op;
+    (void)options;
+    (void)writer;
+    op.seq = seq;
+    op.value = 0;
+    switch (seq) {
+    case TEMAKU_END:
+        {
+            struct temaku_string *str = (struct temaku_string *)arg;
+            /* The same text as TEMAKU_START, which is always the first operation, so don't store it twice */
+            if (!tmpl->failed && tmpl->nops && tmpl->ops[0].seq == TEMAKU_START && tmpl->ops[0].size == str->size) {
+                op.kind = TEMAKU_OP_SEQUENCE_STRING;
+                op.offset = tmpl->ops[0].offset;
+                op.size = str->size;
+                temaku_template_push(tmpl, op);
+                return 0;
+            }
+        }
+        /* fallthrough */
+    case TEMAKU_START:
+    case TEMAKU_DATA:
+    case TEMAKU_LINK_START:
+        {
+            struct temaku_string *str = (struct temaku_string *)arg;
+            op.kind = TEMAKU_OP_SEQUENCE_STRING;
+            temaku_template_record(tmpl, op, str->base, str->size);
+        }
+        return 0;
+    case TEMAKU_FGCOLOR_START:
+    case TEMAKU_FGCOLOR_END:
+    case TEMAKU_BGCOLOR_START:
+    case TEMAKU_BGCOLOR_END:
+    case TEMAKU_BGLINE_START:
+        if (arg) {
+            op.kind = TEMAKU_OP_SEQUENCE_INT;
+            op.value = *(int *)arg;
+            temaku_template_record(tmpl, op, NULL, 0);
+            return 0;
+        }
+        break;
+    default:
+        break;
+    }
+    op.kind = TEMAKU_OP_SEQUENCE;
+    temaku_template_record(tmpl, op, NULL, 0);
+    return 0;
+}
+static int temaku_template_writer_cb(TEMAKU_SELF *self, const void *data, size_t size)
+{
+    temaku_template_t *tmpl = ((struct temaku_template_recorder *)self)->tmpl;
+    temaku_template_op_t op;
+    op.kind = TEMAKU_OP_RAW;
+    op.seq = TEMAKU_DATA;
+    op.value = 0;
+    temaku_template_record(tmpl, op, (const char *)data, size);
+    return 0;
+}
+static int temaku_template_resolver_cb(TEMAKU_SELF *self, struct temaku_options *options, temaku_writer_t *writer, const char *name, size_t size)
+{
+    temaku_template_t *tmpl = ((struct temaku_template_resolver *)self)->tmpl;
+    temaku_template_op_t op;
+    (void)options;
+    (void)writer;
+    op.kind = TEMAKU_OP_PARAM;
+    op.seq = TEMAKU_DATA;
+    op.value = 0;
+    temaku_template_record(tmpl, op, name, size);
+    return 0;
+}
+
+TEMAKU_FUN(int) temaku_template_compile(temaku_template_t *tmpl, struct temaku_options *options, const char *markup, size_t markuplen)
+{
+    struct temaku_options record_options;
+    memset(tmpl, 0, sizeof(*tmpl));
+    tmpl->sequence_writer = temaku_template_sequence_cb;
+    tmpl->writer.writer = temaku_template_writer_cb;
+    tmpl->writer.tmpl = tmpl;
+    tmpl->resolver.resolver = temaku_template_resolver_cb;
+    tmpl->resolver.tmpl = tmpl;
+    /* Record everything, temaku_template_render decides what to write */
+    record_options = options ? *options : temaku_default_options;
+    record_options.sequence_writer = &tmpl->sequence_writer;
+    record_options.do_markup = true;
+    record_options.do_color = true;
+    record_options.do_style = true;
+    record_options.do_links = true;
+    temaku_markup_params(&record_options, &tmpl->writer.writer, markup, markuplen, &tmpl->resolver.resolver);
+    return tmpl->failed ? -1 : 0;
+}
+TEMAKU_FUN(int) temaku_template_render(temaku_template_t *tmpl, struct temaku_options *options, temaku_writer_t *writer, temaku_param_resolver_t *resolver)
+{
+    int nwritten = 0;
+    if (options == NULL) options = &temaku_default_options;
+    for (size_t i=0; i < tmpl->nops; i++) {
+        const temaku_template_op_t *op = &tmpl->ops[i];
+        const char *str = tmpl->strings ? tmpl->strings + op->offset : "";
+        switch (op->kind) {
+        case TEMAKU_OP_SEQUENCE:
+            if (temaku_allowed(options, op->seq)) nwritten += temaku_writesequence(options, writer, op->seq, NULL);
+            break;
+        case TEMAKU_OP_SEQUENCE_INT:
+            if (temaku_allowed(options, op->seq)) {
+                int value = op->value;
+                nwritten += temaku_writesequence(options, writer, op->seq, &value);
+            }
+            break;
+        case TEMAKU_OP_SEQUENCE_STRING:
+            if (temaku_allowed(options, op->seq)) {
+                struct temaku_string arg;
+                arg.base = str;
+                arg.size = op->size;
+                nwritten += temaku_writesequence(options, writer, op->seq, &arg);
+            }
+            break;
+        case TEMAKU_OP_RAW:
+            nwritten += temaku_write(writer, str, op->size);
+            break;
+        case TEMAKU_OP_PARAM:
+            if (resolver) nwritten += (*resolver)((TEMAKU_SELF *)resolver, options, writer, str, op->size);
+            break;
+        }
+    }
+    return nwritten;
+}
+TEMAKU_FUN(void) temaku_template_free(temaku_template_t *tmpl)
+{
+    free(tmpl->ops);
+    free(tmpl->strings);
+    tmpl->ops = NULL;
+    tmpl->strings = NULL;
+    tmpl->nops = tmpl->ops_capacity = 0;
+    tmpl->nstrings = tmpl->strings_capacity = 0;
+}
+
+static int temaku_render_capture_cb(TEMAKU_SELF *self, const void *data, size_t size)
+{
+    temaku_render_t *render = ((struct temaku_render_capture *)self)->render;
+    if (render->failed || size == 0) return 0;
+    if (!temaku_reserve((void **)&render->buffer, &render->capacity, render->size + size, 1)) {
+        render->failed = true;
+        return 0;
+    }
+    memcpy(render->buffer + render->size, data, size);
+    render->size += size;
+    return size;
+}
+
+TEMAKU_FUN(void) temaku_render_init(temaku_render_t *render, struct temaku_options *options, temaku_writer_t *writer, const char *markup, size_t markuplen)
+{
+    const char *nul;
+    memset(render, 0, sizeof(*render));
+    if (markuplen == 0 || markuplen == SIZE_MAX) {
+        markuplen = strlen(markup);
+    } else if ((nul = (const char *)memchr(markup, '\0', markuplen))) {
+        /* temaku_markup stops at the first NUL character, and so do we */
+        markuplen = nul - markup;
+    }
+    render->capture.writer = temaku_render_capture_cb;
+    render->capture.render = render;
+    render->stream.options = options ? options : &temaku_default_options;
+    render->writer = writer;
+    render->markup = markup;
+    render->markuplen = markuplen;
+    render->chunk_size = TEMAKU_RENDER_CHUNK_SIZE;
+}
+TEMAKU_FUN(enum temaku_render_status) temaku_render_resume(temaku_render_t *render)
+{
+    /* Process about this many bytes of markup at once */
+    size_t chunk_size = render->chunk_size ? render->chunk_size : TEMAKU_RENDER_CHUNK_SIZE;
+    struct temaku_string text;
+    text.base = render->markup;
+    text.size = render->markuplen;
+    for (;;) {
+        while (render->sent < render->size) {
+            size_t size = render->size - render->sent;
+            int n = temaku_write(render->writer, render->buffer + render->sent, size);
+            if (n < 0) return TEMAKU_RENDER_ERROR;
+            render->sent += n;
+            if ((size_t)n < size) return TEMAKU_RENDER_WOULDBLOCK;
+        }
+        render->size = render->sent = 0;
+        if (render->failed) return TEMAKU_RENDER_ERROR;
+        if (render->finished) return TEMAKU_RENDER_DONE;
+        if (!render->started) {
+            /* The resolver may have been set after temaku_render_init */
+            temaku_param_resolver_t *resolver = render->stream.resolver;
+            temaku_stream_start(&render->stream, render->stream.options, &render->capture.writer, &text);
+            render->stream.resolver = resolver;
+            render->started = true;
+        } else if (render->pos < render->markuplen) {
+            const char *start = render->markup + render->pos;
+            const char *end = render->markup + render->markuplen;
+            const char *stop;
+            temaku_stream_feed(&render->stream, start, end, (size_t)(end - start) > chunk_size ? start + chunk_size : end, &stop);
+            render->pos = stop - render->markup;
+        } else {
+            temaku_stream_finish(&render->stream, &text);
+            render->finished = true;
+        }
+    }
+}
+TEMAKU_FUN(void) temaku_render_free(temaku_render_t *render)
+{
+    free(render->buffer);
+    render->buffer = NULL;
+    render->size = render->capacity = render->sent = 0;
+}
+
+enum {
+    ANSI_TEXT,
+    ANSI_ESC,
+    ANSI_ESC_INTERMEDIATE,
+    ANSI_CSI,
+    ANSI_OSC,
+    ANSI_OSC_ESC,
+    ANSI_STRING,
+    ANSI_STRING_ESC,
+};
+enum {
+    ANSI_BOLD        = 0x1,
+    ANSI_ALTERNATIVE = 0x2,
+    ANSI_ITALIC      = 0x4,
+    ANSI_UNDERLINE   = 0x8,
+    ANSI_STRIKE      = 0x10,
+    ANSI_REVERSE     = 0x20,
+};
+/* Maximum number of SGR parameters, more than any real program uses at once */
+#define TEMAKU_ANSI_MAX_PARAMS 32
+
+static int temaku_ansi_emit(temaku_ansi_decoder_t *decoder, enum temaku_sequence seq, void *arg)
+{
+    if (!temaku_allowed(decoder->options, seq)) return 0;
+    return temaku_writesequence(decoder->options, decoder->writer, seq, arg);
+}
+static int temaku_ansi_style(temaku_ansi_decoder_t *decoder, unsigned attr, bool on)
+{
+    static const struct { unsigned attr; enum temaku_sequence start, end; } styles[] = {
+        { ANSI_BOLD,        TEMAKU_BOLD_START,          TEMAKU_BOLD_END },
+        { ANSI_ALTERNATIVE, TEMAKU_ALTERNATIVE_START,   TEMAKU_ALTERNATIVE_END },
+        { ANSI_ITALIC,      TEMAKU_ITALIC_START,        TEMAKU_ITALIC_END },
+        { ANSI_UNDERLINE,   TEMAKU_UNDERLINE_START,     TEMAKU_UNDERLINE_END },
+        { ANSI_STRIKE,      TEMAKU_STRIKETHROUGH_START, TEMAKU_STRIKETHROUGH_END },
+        { ANSI_REVERSE,     TEMAKU_REVERSE_VIDEO_START, TEMAKU_REVERSE_VIDEO_END },
+    };
+    int nwritten = 0;
+    for (size_t i=0; i < sizeof(styles) / sizeof(styles[0]); i++) {
+        if (!(attr & styles[i].attr) || !!(decoder->attr & styles[i].attr) == on) continue;
+        nwritten += temaku_ansi_emit(decoder, on ? styles[i].start : styles[i].end, NULL);
+        decoder->attr ^= styles[i].attr;
+    }
+    return nwritten;
+}
+/* Set the foreground (@{bg} false) or background color to @{color}, or ``-1`` to reset it */
+static int temaku_ansi_color(temaku_ansi_decoder_t *decoder, bool bg, int color)
+{
+    int *current = bg ? &decoder->bgcolor : &decoder->fgcolor;
+    int nwritten = 0;
+    if (*current == color) return 0;
+    if (*current != -1) nwritten += temaku_ansi_emit(decoder, bg ? TEMAKU_BGCOLOR_END : TEMAKU_FGCOLOR_END, current);
+    *current = color;
+    if (color != -1) nwritten += temaku_ansi_emit(decoder, bg ? TEMAKU_BGCOLOR_START : TEMAKU_FGCOLOR_START, current);
+    return nwritten;
+}
+/* The nearest of the 16 temaku colors, using the palette of the HTML sequence writer */
+static int temaku_ansi_nearest(int r, int g, int b)
+{
+    static const unsigned char palette[16][3] = {
+        { 0x01, 0x01, 0x01 }, { 0xDE, 0x38, 0x2B }, { 0x39, 0xB5, 0x4A }, { 0xFF, 0xC7, 0x06 },
+        { 0x00, 0x6F, 0xB8 }, { 0x76, 0x26, 0x71 }, { 0x2C, 0xB5, 0xE9 }, { 0xCC, 0xCC, 0xCC },
+        { 0x80, 0x80, 0x80 }, { 0xFF, 0x00, 0x00 }, { 0x00, 0xFF, 0x00 }, { 0xFF, 0xFF, 0x00 },
+        { 0x00, 0x00, 0xFF }, { 0xFF, 0x00, 0xFF }, { 0x00, 0xFF, 0xFF }, { 0xFF, 0xFF, 0xFF },
+    };
+    int best = 0;
+    long best_distance = -1;
+    for (int i=0; i < 16; i++) {
+        long dr = r - palette[i][0], dg = g - palette[i][1], db = b - palette[i][2];
+        long distance = dr * dr + dg * dg + db * db;
+        if (best_distance < 0 || distance < best_distance) best = i, best_distance = distance;
+    }
+    return best;
+}
+/* The nearest temaku color of color @{index} of the xterm 256 color palette */
+static int temaku_ansi_indexed(int index)
+{
+    static const int levels[6] = { 0, 95, 135, 175, 215, 255 };
+    if (index < 16) return index;
+    if (index < 232) {
+        index -= 16;
+        return temaku_ansi_nearest(levels[index / 36], levels[index / 6 % 6], levels[index % 6]);
+    }
+    return temaku_ansi_nearest(8 + 10 * (index - 232), 8 + 10 * (index - 232), 8 + 10 * (index - 232));
+}
+/*
+ * Parse an extended color (``38;5;n``, ``38;2;r;g;b`` or their ``:`` forms) starting at parameter @{i}.
+ * Returns the color, or ``-2`` if it is invalid, and stores the index of its last parameter in @{last}.
+ */
+static int temaku_ansi_extended(const int *params, const bool *sub, size_t nparams, size_t i, size_t *last)
+{
+    size_t count = 0;
+    if (i + 1 < nparams && sub[i + 1]) {
+        /* 38:5:n or 38:2:[colorspace:]r:g:b, up to the next ';' */
+        while (i + 1 + count < nparams && sub[i + 1 + count]) count++;
+        *last = i + count;
+        if (params[i + 1] == 5 && count == 2) return temaku_ansi_indexed(params[i + 2] % 256);
+        if (params[i + 1] == 2 && (count == 4 || count == 5)) {
+            const int *rgb = &params[i + count - 2];
+            return temaku_ansi_nearest(rgb[0], rgb[1], rgb[2]);
+        }
+        return -2;
+    }
+    if (i + 2 < nparams && params[i + 1] == 5) {
+        *last = i + 2;
+        return temaku_ansi_indexed(params[i + 2] % 256);
+    }
+    if (i + 4 < nparams && params[i + 1] == 2) {
+        *last = i + 4;
+        return temaku_ansi_nearest(params[i + 2], params[i + 3], params[i + 4]);
+    }
+    *last = nparams;
+    return -2;
+}
+static int temaku_ansi_sgr(temaku_ansi_decoder_t *decoder)
+{
+    int params[TEMAKU_ANSI_MAX_PARAMS];
+    bool sub[TEMAKU_ANSI_MAX_PARAMS];
+    size_t nparams = 0;
+    int nwritten = 0;
+    if (decoder->size > TEMAKU_ANSI_MAX_SEQUENCE) return 0;
+    /* ESC[m is the same as ESC[0m, and empty parameters are 0 as well */
+    params[0] = 0;
+    sub[0] = false;
+    nparams = 1;
+    for (size_t i=0; i < decoder->size; i++) {
+        char c = decoder->buffer[i];
+        if (c >= '0' && c <= '9') {
+            if (params[nparams - 1] < 65536) params[nparams - 1] = params[nparams - 1] * 10 + (c - '0');
+        } else if ((c == ';' || c == ':') && nparams < TEMAKU_ANSI_MAX_PARAMS) {
+            params[nparams] = 0;
+            sub[nparams] = c == ':';
+            nparams++;
+        } else {
+            /* Private or unknown parameters, this is not a plain SGR sequence */
+            return 0;
+        }
+    }
+    for (size_t i=0; i < nparams; i++) {
+        int p = params[i];
+        if (sub[i]) continue;
+        switch (p) {
+        case 0:
+            nwritten += temaku_ansi_style(decoder, ~0u, false);
+            nwritten += temaku_ansi_color(decoder, false, -1);
+            nwritten += temaku_ansi_color(decoder, true, -1);
+            break;
+        case 1: nwritten += temaku_ansi_style(decoder, ANSI_BOLD, true); break;
+        case 2: nwritten += temaku_ansi_style(decoder, ANSI_ALTERNATIVE, true); break;
+        case 3: nwritten += temaku_ansi_style(decoder, ANSI_ITALIC, true); break;
+        case 4:
+            /* 4:0 turns underlining off, 4:1 to 4:5 are different kinds of underline */
+            nwritten += temaku_ansi_style(decoder, ANSI_UNDERLINE, !(i + 1 < nparams && sub[i + 1] && params[i + 1] == 0));
+            break;
+        case 7: nwritten += temaku_ansi_style(decoder, ANSI_REVERSE, true); break;
+        case 9: nwritten += temaku_ansi_style(decoder, ANSI_STRIKE, true); break;
+        case 22: nwritten += temaku_ansi_style(decoder, ANSI_BOLD | ANSI_ALTERNATIVE, false); break;
+        case 23: nwritten += temaku_ansi_style(decoder, ANSI_ITALIC, false); break;
+        case 24: nwritten += temaku_ansi_style(decoder, ANSI_UNDERLINE, false); break;
+        case 27: nwritten += temaku_ansi_style(decoder, ANSI_REVERSE, false); break;
+        case 29: nwritten += temaku_ansi_style(decoder, ANSI_STRIKE, false); break;
+        case 39: nwritten += temaku_ansi_color(decoder, false, -1); break;
+        case 49: nwritten += temaku_ansi_color(decoder, true, -1); break;
+        case 38:
+        case 48:
+            {
+                int color = temaku_ansi_extended(params, sub, nparams, i, &i);
+                if (color != -2) nwritten += temaku_ansi_color(decoder, p == 48, color);
+            }
+            break;
+        default:
+            if (p >= 30 && p <= 37) nwritten += temaku_ansi_color(decoder, false, p - 30);
+            else if (p >= 40 && p <= 47) nwritten += temaku_ansi_color(decoder, true, p - 40);
+            else if (p >= 90 && p <= 97) nwritten += temaku_ansi_color(decoder, false, p - 90 + 8);
+            else if (p >= 100 && p <= 107) nwritten += temaku_ansi_color(decoder, true, p - 100 + 8);
+            break;
+        }
+    }
+    return nwritten;
+}
+/* OSC 8 hyperlinks: ESC ] 8 ; params ; URI ST, an empty URI closes the link */
+static int temaku_ansi_osc(temaku_ansi_decoder_t *decoder)
+{
+    struct temaku_string url;
+    const char *semicolon;
+    int nwritten = 0;
+    if (decoder->size > TEMAKU_ANSI_MAX_SEQUENCE) return 0;
+    if (decoder->size < 2 || decoder->buffer[0] != '8' || decoder->buffer[1] != ';') return 0;
+    semicolon = (const char *)memchr(decoder->buffer + 2, ';', decoder->size - 2);
+    if (!semicolon) return 0;
+    url.base = semicolon + 1;
+    url.size = decoder->buffer + decoder->size - url.base;
+    if (decoder->in_link) nwritten += temaku_ansi_emit(decoder, TEMAKU_LINK_END, NULL);
+    decoder->in_link = url.size != 0;
+    if (decoder->in_link) nwritten += temaku_ansi_emit(decoder, TEMAKU_LINK_START, &url);
+    return nwritten;
+}
+static inline void temaku_ansi_append(temaku_ansi_decoder_t *decoder, char c)
+{
+    /* A size past the end marks a sequence that did not fit, which is dropped */
+    if (decoder->size < TEMAKU_ANSI_MAX_SEQUENCE) decoder->buffer[decoder->size++] = c;
+    else decoder->size = TEMAKU_ANSI_MAX_SEQUENCE + 1;
+}
+
+TEMAKU_FUN(int) temaku_ansi_begin(temaku_ansi_decoder_t *decoder, struct temaku_options *options, temaku_writer_t *writer)
+{
+    struct temaku_string text = { "", 0 };
+    if (options == NULL) options = &temaku_default_options;
+    decoder->options = options;
+    decoder->writer = writer;
+    decoder->state = ANSI_TEXT;
+    decoder->attr = 0;
+    decoder->fgcolor = -1;
+    decoder->bgcolor = -1;
+    decoder->in_link = false;
+    decoder->size = 0;
+    return temaku_writesequence(options, writer, TEMAKU_START, &text);
+}
+TEMAKU_FUN(int) temaku_ansi_write(temaku_ansi_decoder_t *decoder, const char *data, size_t size)
+{
+    const char *s = data;
+    const char *end = data + size;
+    int nwritten = 0;
+    while (s < end) {
+        unsigned char c;
+        if (decoder->state == ANSI_TEXT) {
+            /* memchr is vectorized by every mainstream libc, so text between escape sequences is written in bulk */
+            const char *esc = (const char *)memchr(s, '\x1b', end - s);
+            struct temaku_string text;
+            text.base = s;
+            text.size = (esc ? esc : end) - s;
+            if (text.size) nwritten += temaku_ansi_emit(decoder, TEMAKU_DATA, &text);
+            if (!esc) break;
+            s = esc + 1;
+            decoder->state = ANSI_ESC;
+            decoder->size = 0;
+            continue;
+        }
+        c = (unsigned char)*s;
+        switch (decoder->state) {
+        case ANSI_ESC:
+            if (c == '[') decoder->state = ANSI_CSI;
+            else if (c == ']') decoder->state = ANSI_OSC;
+            else if (c == 'P' || c == 'X' || c == '^' || c == '_') decoder->state = ANSI_STRING;
+            else if (c >= 0x20 && c <= 0x2f) decoder->state = ANSI_ESC_INTERMEDIATE;
+            else if (c == 0x1b) decoder->state = ANSI_ESC;
+            else if (c < 0x20) {
+                /* Not an escape sequence after all, write the control character as text */
+                decoder->state = ANSI_TEXT;
+                continue;
+            } else decoder->state = ANSI_TEXT;
+            break;
+        case ANSI_ESC_INTERMEDIATE:
+            if (c >= 0x30 && c <= 0x7e) decoder->state = ANSI_TEXT;
+            else if (c < 0x20 || c > 0x7e) {
+                decoder->state = ANSI_TEXT;
+                continue;
+            }
+            break;
+        case ANSI_CSI:
+            if (c >= 0x20 && c <= 0x3f) {
+                temaku_ansi_append(decoder, c);
+            } else if (c >= 0x40 && c <= 0x7e) {
+                if (c == 'm') nwritten += temaku_ansi_sgr(decoder);
+                decoder->state = ANSI_TEXT;
+            } else {
+                decoder->state = ANSI_TEXT;
+                continue;
+            }
+            break;
+        case ANSI_OSC:
+            if (c == 0x07) {
+                nwritten += temaku_ansi_osc(decoder);
+                decoder->state = ANSI_TEXT;
+            } else if (c == 0x1b) {
+                decoder->state = ANSI_OSC_ESC;
+            } else {
+                temaku_ansi_append(decoder, c);
+            }
+            break;
+        case ANSI_STRING:
+            if (c == 0x07) decoder->state = ANSI_TEXT;
+            else if (c == 0x1b) decoder->state = ANSI_STRING_ESC;
+            break;
+        case ANSI_OSC_ESC:
+        case ANSI_STRING_ESC:
+            if (c == '\\') {
+                if (decoder->state == ANSI_OSC_ESC) nwritten += temaku_ansi_osc(decoder);
+                decoder->state = ANSI_TEXT;
+                break;
+            }
+            /* The ESC starts a new escape sequence instead */
+            decoder->state = ANSI_ESC;
+            decoder->size = 0;
+            continue;
+        }
+        ++s;
+    }
+    return nwritten;
+}
+TEMAKU_FUN(int) temaku_ansi_end(temaku_ansi_decoder_t *decoder)
+{
+    struct temaku_string text = { "", 0 };
+    int nwritten = 0;
+    nwritten += temaku_ansi_style(decoder, ~0u, false);
+    nwritten += temaku_ansi_color(decoder, false, -1);
+    nwritten += temaku_ansi_color(decoder, true, -1);
+    if (decoder->in_link) nwritten += temaku_ansi_emit(decoder, TEMAKU_LINK_END, NULL);
+    decoder->in_link = false;
+    decoder->state = ANSI_TEXT;
+    nwritten += temaku_writesequence(decoder->options, decoder->writer, TEMAKU_END, &text);
+    return nwritten;
+}
+TEMAKU_FUN(int) temaku_ansi_decode(struct temaku_options *options, temaku_writer_t *writer, const char *data, size_t size)
+{
+    temaku_ansi_decoder_t decoder;
+    int nwritten = 0;
+    if (size == 0 || size == SIZE_MAX) {
+        size = strlen(data);
+    }
+    nwritten += temaku_ansi_begin(&decoder, options, writer);
+    nwritten += temaku_ansi_write(&decoder, data, size);
+    nwritten += temaku_ansi_end(&decoder);
+    return nwritten;
 }
@@ -0,0 +1,219 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "temaku-engines.h"
+
+const char usage[] =
+"=USAGE\n"
+"  _temaku-bench_ |[options]| |[file...]|\n"
+"\n"
+"  Renders each file with every engine, checks that the output matches the\n"
+"  reference parser byte for byte, and reports throughput and speedup.\n"
+"  Without files, uses a few generated corpora instead. Templates are\n"
+"  compiled once per corpus, only rendering them is timed. The fanout\n"
+"  engine renders for two targets at once, so it is compared with\n"
+"  rendering with the reference once for each target.\n"
+"=OPTIONS\n"
+"  |--mode <n>|                  Options to render with, see |engine_options| (default: |0|)\n"
+"  |--seconds <s>|               Time to spend on each engine and corpus (default: |0.5|)\n"
+"  |--help|                      You're looking at it!\n"
+;
+
+typedef struct corpus corpus_t;
+
+struct corpus {
+    const char *name;
+    char *markup;
+    size_t size;
+};
+
+static void die(const char *msg, const char *arg)
+{
+    fprintf(stderr, "temaku-bench: %s '%s'\n", msg, arg);
+    exit(1);
+}
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+static char *read_file(const char *path, size_t *size)
+{
+    temaku_memory_writer_t writer = temaku_memory_writer_new();
+    char buffer[65536];
+    size_t n;
+    FILE *fp = fopen(path, "rb");
+    if (!fp) die("cannot open", path);
+    while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+        if (temaku_write(&writer.writer, buffer, n) < 0) die("out of memory reading", path);
+    }
+    fclose(fp);
+    /* The reference parser stops at the first NUL */
+    temaku_write(&writer.writer, "", 1);
+    return temaku_memory_writer_release(&writer, size);
+}
+/* Generate about @{size} bytes by picking random pieces from @{pieces} */
+static char *generate(const char *const *pieces, size_t npieces, size_t size, size_t *outsize)
+{
+    temaku_memory_writer_t writer = temaku_memory_writer_new();
+    unsigned seed = 12345;
+    while (writer.size < size) {
+        seed = seed * 1103515245 + 12345;
+        if (temaku_writestr(&writer.writer, pieces[(seed >> 16) % npieces]) < 0) die("out of memory for", "corpus");
+    }
+    temaku_write(&writer.writer, "", 1);
+    return temaku_memory_writer_release(&writer, outsize);
+}
+static void generate_corpora(corpus_t *corpora)
+{
+    static const char *const plain[] = {
+        "The quick brown fox jumps over the lazy dog. ", "Lorem ipsum dolor sit amet, ",
+        "consectetur adipiscing elit. ", "0123456789 ", "\n",
+    };
+    static const char *const help[] = {
+        "=OPTIONS\n", "  |--verbose|                   Print more output\n",
+        "  |-o <file>|                   Write the output to _<file>_\n",
+        "  See %L{https://example.com/docs}the documentation%l for *all* options.\n",
+        "  %F{yellow}Warning:%f this /may/ take a while\n", "  Plain text without any markup at all.\n",
+    };
+    static const char *const dense[] = {
+        "*b*", "/i/", "_u_", "|a|", "%F{red}", "%f", "%K{Blue}", "%k", "%E", "%L{x}", "%l",
+        "%B", "%b", "%{*raw*%}", "%P{name}", "%%", "=", "x", "y z", "\n",
+    };
+    size_t size;
+    corpora[0].name = "plain";
+    corpora[0].markup = generate(plain, sizeof(plain) / sizeof(plain[0]), 1 << 22, &size);
+    corpora[0].size = size - 1;
+    corpora[1].name = "help";
+    corpora[1].markup = generate(help, sizeof(help) / sizeof(help[0]), 1 << 22, &size);
+    corpora[1].size = size - 1;
+    corpora[2].name = "dense";
+    corpora[2].markup = generate(dense, sizeof(dense) / sizeof(dense[0]), 1 << 22, &size);
+    corpora[2].size = size - 1;
+}
+
+/*
+ * Render @{corpus} with @{engine} for about @{seconds}, returning the throughput in MB/s of the fastest pass,
+ * since other processes can only ever make a pass slower.
+ * The output is copied into @{sink}, which is reused, so every engine pays for the bytes it writes.
+ */
+static double measure(const engine_t *engine, temaku_options_t *options, const corpus_t *corpus, temaku_param_resolver_t *resolver, temaku_memory_writer_t *sink, double seconds)
+{
+    double start = now(), fastest = -1, pass;
+    do {
+        pass = now();
+        sink->size = 0;
+        engine->render(options, &sink->writer, corpus->markup, corpus->size, resolver);
+        pass = now() - pass;
+        if (fastest < 0 || pass < fastest) fastest = pass;
+    } while (now() - start < seconds);
+    return (double)corpus->size / fastest / 1e6;
+}
+/* Like measure, but compile the template once and only time temaku_template_render */
+static double measure_template(temaku_options_t *options, const corpus_t *corpus, temaku_param_resolver_t *resolver, temaku_memory_writer_t *sink, double seconds)
+{
+    temaku_template_t tmpl;
+    double start, fastest = -1, pass;
+    if (temaku_template_compile(&tmpl, options, corpus->markup, corpus->size) != 0) die("out of memory compiling", corpus->name);
+    start = now();
+    do {
+        pass = now();
+        sink->size = 0;
+        temaku_template_render(&tmpl, options, &sink->writer, resolver);
+        pass = now() - pass;
+        if (fastest < 0 || pass < fastest) fastest = pass;
+    } while (now() - start < seconds);
+    temaku_template_free(&tmpl);
+    return (double)corpus->size / fastest / 1e6;
+}
+/* What the fanout engine does in one pass: render for the target under test, and for a second target that wants everything */
+static void reference_fanout(temaku_options_t *options, temaku_writer_t *writer, const char *markup, size_t size, temaku_param_resolver_t *resolver)
+{
+    temaku_count_writer_t count = temaku_count_writer_new();
+    temaku_options_t all = *options;
+    all.do_markup = all.do_color = all.do_style = all.do_links = true;
+    temaku_reference_markup(options, writer, markup, size, resolver);
+    temaku_reference_markup(&all, &count.writer, markup, size, resolver);
+}
+/* Check that @{engine} writes exactly what the reference writes */
+static bool matches(const engine_t *engine, temaku_options_t *options, const corpus_t *corpus, temaku_param_resolver_t *resolver, const temaku_memory_writer_t *expected)
+{
+    temaku_memory_writer_t actual = temaku_memory_writer_new();
+    bool same;
+    engine->render(options, &actual.writer, corpus->markup, corpus->size, resolver);
+    same = actual.size == expected->size && (actual.size == 0 || memcmp(actual.base, expected->base, actual.size) == 0);
+    temaku_memory_writer_free(&actual);
+    return same;
+}
+
+int main(int argc, char **argv)
+{
+    temaku_param_resolver_t *resolver = engine_resolver();
+    temaku_memory_writer_t sink = temaku_memory_writer_new();
+    temaku_options_t options;
+    corpus_t *corpora;
+    size_t ncorpora = 0;
+    unsigned mode = 0;
+    double seconds = 0.5;
+    bool failed = false;
+    corpora = malloc((argc > 3 ? argc : 3) * sizeof(*corpora));
+    if (!corpora) die("out of memory for", "arguments");
+    for (int i=1; i < argc; i++) {
+        if (strcmp(argv[i], "--help") == 0) {
+            temaku_options_t help = temaku_detect_options(1);
+            temaku_markup(&help, &temaku_stdout_writer, usage, 0);
+            return 0;
+        } else if (strcmp(argv[i], "--mode") == 0 && i + 1 < argc) {
+            mode = strtoul(argv[++i], NULL, 0) % ENGINE_MODES;
+        } else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            seconds = strtod(argv[++i], NULL);
+        } else if (argv[i][0] == '-') {
+            die("unknown option", argv[i]);
+        } else {
+            size_t size;
+            corpora[ncorpora].name = argv[i];
+            corpora[ncorpora].markup = read_file(argv[i], &size);
+            corpora[ncorpora].size = strlen(corpora[ncorpora].markup);
+            ncorpora++;
+        }
+    }
+    if (ncorpora == 0) {
+        generate_corpora(corpora);
+        ncorpora = 3;
+    }
+    options = engine_options(mode);
+    printf("%-24s %-10s %10s %8s\n", "corpus", "engine", "MB/s", "speedup");
+    for (size_t i=0; i < ncorpora; i++) {
+        temaku_memory_writer_t expected = temaku_memory_writer_new();
+        double reference;
+        engines[0].render(&options, &expected.writer, corpora[i].markup, corpora[i].size, resolver);
+        reference = measure(&engines[0], &options, &corpora[i], resolver, &sink, seconds);
+        printf("%-24s %-10s %10.1f %7.2fx\n", corpora[i].name, engines[0].name, reference, 1.0);
+        for (size_t j=1; j < ENGINE_COUNT; j++) {
+            double speed, baseline = reference;
+            if (!matches(&engines[j], &options, &corpora[i], resolver, &expected)) {
+                printf("%-24s %-10s %10s %8s\n", "", engines[j].name, "-", "MISMATCH");
+                failed = true;
+                continue;
+            }
+            /* Templates are compiled once and rendered many times, so that's what to time */
+            if (engines[j].render == engine_template) speed = measure_template(&options, &corpora[i], resolver, &sink, seconds);
+            else speed = measure(&engines[j], &options, &corpora[i], resolver, &sink, seconds);
+            if (engines[j].render == engine_fanout) {
+                static const engine_t twice = { "reference", reference_fanout };
+                baseline = measure(&twice, &options, &corpora[i], resolver, &sink, seconds);
+            }
+            printf("%-24s %-10s %10.1f %7.2fx\n", "", engines[j].name, speed, speed / baseline);
+        }
+        temaku_memory_writer_free(&expected);
+        free(corpora[i].markup);
+    }
+    temaku_memory_writer_free(&sink);
+    free(corpora);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,207 @@
+#ifndef TEMAKU_ENGINES_H
+#define TEMAKU_ENGINES_H
+
+/*
+ * Every way temaku has of turning markup into output, behind one signature,
+ * so the fuzzer and the benchmark can check each of them against the frozen
+ * reference parser in temaku-reference.c.
+ */
+
+#include <string.h>
+
+#include <temaku.h>
+#include <temaku_libc.h>
+
+#include "temaku-reference.h"
+
+typedef struct engine engine_t;
+
+/**
+ * A way to render markup.
+ *
+ * @{name}       Short name, used in reports.
+ * @{render}     Writes the marked-up result of the @{size} bytes of NUL-terminated @{markup} to @{writer}.
+ */
+struct engine {
+    const char *name;
+    void (*render)(temaku_options_t *options, temaku_writer_t *writer, const char *markup, size_t size, temaku_param_resolver_t *resolver);
+};
+
+/* Word characters that include the markup characters themselves and a multibyte one, for the in_word edge cases */
+#define ENGINE_ODD_WORDCHARS "*_/|%abcxyz\xc3\xa4"
+
+/*
+ * Options for mode @{mode}, a bitmask of:
+ * 1 HTML, 2 strip, 4 no color, 8 no style, 16 no links, 32 odd word characters, 64 ST terminator
+ */
+static temaku_options_t engine_options(unsigned mode)
+{
+    temaku_options_t options = TEMAKU_DEFAULT_OPTIONS;
+    if (mode & 1) options.sequence_writer = &temaku_write_html_sequence;
+    if (mode & 2) options.do_markup = false;
+    if (mode & 4) options.do_color = false;
+    if (mode & 8) options.do_style = false;
+    if (mode & 16) options.do_links = false;
+    if (mode & 32) options.wordchars = ENGINE_ODD_WORDCHARS;
+    if (mode & 64) options.string_terminator = TEMAKU_ST;
+    return options;
+}
+#define ENGINE_MODES 128
+
+/* The parameters used for %P{name}, with values that need escaping and look like markup */
+static temaku_param_resolver_t *engine_resolver(void)
+{
+    static const temaku_param_t params[] = {
+        TEMAKU_PARAM_STR("name", "<a&b> *not bold*"),
+        TEMAKU_PARAM_INT("count", -42),
+        TEMAKU_PARAM_STR(NULL, "%F{red}"),
+    };
+    static temaku_params_t p;
+    p = temaku_params_new(params, sizeof(params) / sizeof(params[0]));
+    return &p.resolver;
+}
+
+static void engine_reference(temaku_options_t *options, temaku_writer_t *writer, const char *markup, size_t size, temaku_param_resolver_t *resolver)
+{
+    temaku_reference_markup(options, writer, markup, size, resolver);
+}
+static void engine_markup(temaku_options_t *options, temaku_writer_t *writer, const char *markup, size_t size, temaku_param_resolver_t *resolver)
+{
+    temaku_markup_params(options, writer, markup, size, resolver);
+}
+/*
+ * Whether the stream and render engines split the markup into many small pieces, to exercise
+ * resuming in the middle of the input. The fuzz target sets this; the benchmark doesn't, so it
+ * measures the chunk sizes real programs use.
+ */
+static bool engine_fine_splits = false;
+
+/* A number derived from the whole input, so the fuzzer decides where engines split the markup */
+static unsigned engine_seed(const char *markup, size_t size)
+{
+    unsigned hash = 2166136261u;
+    for (size_t i=0; i < size; i++) hash = (hash ^ (unsigned char)markup[i]) * 16777619u;
+    return hash;
+}
+static bool engine_alnum(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+}
+/*
+ * Feed [@{chunk}, @{end}) in pieces, split between two letters or digits that are
+ * outside of any {...} and don't follow a '%', which can't be part of the same sequence.
+ */
+static void engine_stream_pieces(temaku_stream_t *stream, const char *chunk, const char *end, unsigned *seed)
+{
+    const char *start = chunk;
+    bool open = false;
+    for (const char *p = chunk; p < end; p++) {
+        if (*p == '{') open = true;
+        else if (*p == '}') open = false;
+        if (!engine_fine_splits) break;
+        if (open || p - chunk < 2 || !engine_alnum(p[-1]) || !engine_alnum(p[0]) || p[-2] == '%') continue;
+        *seed = *seed * 1103515245 + 12345;
+        if ((*seed >> 16) % 4 == 0) {
+            temaku_stream_write(stream, start, p - start);
+            start = p;
+        }
+    }
+    temaku_stream_write(stream, start, end - start);
+}
+/*
+ * Feed the markup one line at a time, which temaku_stream_write documents as safe
+ * as long as no {...} argument spans lines, so lines are joined until every '{' has a '}' after it.
+ * Lines are split further at places picked by the input, where no sequence can be split.
+ */
+static void engine_stream(temaku_options_t *options, temaku_writer_t *writer, const char *markup, size_t size, temaku_param_resolver_t *resolver)
+{
+    temaku_stream_t stream;
+    const char *s = markup, *end = markup + size;
+    unsigned seed = engine_fine_splits ? engine_seed(markup, size) : 0;
+    temaku_stream_begin(&stream, options, writer);
+    stream.resolver = resolver;
+    while (s < end) {
+        const char *chunk = s, *open = NULL;
+        do {
+            const char *newline = (const char *)memchr(s, '\n', end - s);
+            const char *line = s, *brace;
+            s = brace = newline ? newline + 1 : end;
+            /* Only the last brace on the line matters, so look for it from the end */
+            while (brace > line && brace[-1] != '{' && brace[-1] != '}') brace--;
+            if (brace > line) open = brace[-1] == '{' ? brace - 1 : NULL;
+        } while (open && s < end);
+        engine_stream_pieces(&stream, chunk, s, &seed);
+    }
+    temaku_stream_end(&stream);
+}
+static void engine_template(temaku_options_t *options, temaku_writer_t *writer, const char *markup, size_t size, temaku_param_resolver_t *resolver)
+{
+    temaku_template_t tmpl;
+    if (temaku_template_compile(&tmpl, options, markup, size) == 0) {
+        temaku_template_render(&tmpl, options, writer, resolver);
+    }
+    temaku_template_free(&tmpl);
+}
+/* Fan out to the target under test, and to a second target that wants everything */
+static void engine_fanout(temaku_options_t *options, temaku_writer_t *writer, const char *markup, size_t size, temaku_param_resolver_t *resolver)
+{
+    temaku_count_writer_t count = temaku_count_writer_new();
+    temaku_options_t all = *options;
+    temaku_target_t targets[2];
+    temaku_fanout_t fanout;
+    temaku_stream_t stream;
+    all.do_markup = all.do_color = all.do_style = all.do_links = true;
+    targets[0].options = options;
+    targets[0].writer = writer;
+    targets[1].options = &all;
+    targets[1].writer = &count.writer;
+    temaku_fanout_init(&fanout, targets, 2);
+    temaku_stream_begin(&stream, &fanout.options, &fanout.writer.writer);
+    stream.resolver = resolver;
+    temaku_stream_write(&stream, markup, size);
+    temaku_stream_end(&stream);
+}
+
+typedef struct engine_throttle engine_throttle_t;
+
+/* Non-blocking writer that accepts a few bytes at a time, and would block on every third call */
+struct engine_throttle {
+    temaku_writer_t writer;
+    temaku_writer_t *out;
+    unsigned calls;
+};
+
+static int engine_throttle_cb(TEMAKU_SELF *self, const void *data, size_t size)
+{
+    engine_throttle_t *throttle = (engine_throttle_t *)self;
+    size_t limit = 1 + throttle->calls % 61;
+    if (throttle->calls++ % 3 == 2) return 0;
+    if (size > limit) size = limit;
+    return temaku_write(throttle->out, data, size);
+}
+static void engine_render(temaku_options_t *options, temaku_writer_t *writer, const char *markup, size_t size, temaku_param_resolver_t *resolver)
+{
+    engine_throttle_t throttle = { engine_throttle_cb, writer, 0 };
+    temaku_render_t render;
+    temaku_render_init(&render, options, &throttle.writer, markup, size);
+    render.stream.resolver = resolver;
+    /* Small chunks, so that the input ends up split at a chunk limit (e.g. in a %{ %} block) */
+    if (engine_fine_splits) render.chunk_size = 1 + engine_seed(markup, size) % 64;
+    while (temaku_render_resume(&render) == TEMAKU_RENDER_WOULDBLOCK) {
+        /* Nothing else to do while "waiting" */
+    }
+    temaku_render_free(&render);
+}
+
+/* The reference comes first, every other engine must match it byte for byte */
+static const engine_t engines[] = {
+    { "reference", engine_reference },
+    { "markup", engine_markup },
+    { "stream", engine_stream },
+    { "template", engine_template },
+    { "fanout", engine_fanout },
+    { "render", engine_render },
+};
+#define ENGINE_COUNT (sizeof(engines) / sizeof(engines[0]))
+
+#endif /* TEMAKU_ENGINES_H */
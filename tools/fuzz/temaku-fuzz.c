@@ -0,0 +1,161 @@
+/*
+ * Differential fuzz target: renders the input with every engine in
+ * temaku-engines.h and aborts if any of them differs from the reference.
+ * The first byte of the input selects the options (see engine_options),
+ * the rest is the markup.
+ * The vectorized kernels are also checked against their scalar references
+ * on the whole input, NUL bytes included, and the markup is checked to draw
+ * the same screen with a %{ ... %} block in front of it.
+ *
+ * libFuzzer:
+ *   clang -g -O1 -fsanitize=fuzzer,address,undefined -Iinclude tools/fuzz/temaku-fuzz.c tools/fuzz/temaku-reference.c src/temaku.c -o temaku-fuzz
+ *   ./temaku-fuzz tools/fuzz/corpus
+ * On x86, that build picks the SSSE3 UTF-8 validation at runtime, add -mssse3
+ * to also fuzz the build that has it enabled at compile time.
+ * AFL (or replaying a crash), with -DTEMAKU_FUZZ_MAIN:
+ *   afl-clang-fast -DTEMAKU_FUZZ_MAIN -Iinclude tools/fuzz/temaku-fuzz.c tools/fuzz/temaku-reference.c src/temaku.c -o temaku-fuzz-afl
+ *   afl-fuzz -i tools/fuzz/corpus -o findings -- ./temaku-fuzz-afl @@
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "temaku-engines.h"
+
+static void report(const char *name, unsigned mode, const char *markup, const temaku_memory_writer_t *expected, const temaku_memory_writer_t *actual)
+{
+    size_t offset = 0;
+    while (offset < expected->size && offset < actual->size && expected->base[offset] == actual->base[offset]) offset++;
+    fprintf(stderr, "temaku-fuzz: engine '%s' differs from the reference in mode %u at output offset %zu\n", name, mode, offset);
+    fprintf(stderr, "  expected %zu bytes, got %zu bytes\n", expected->size, actual->size);
+    fprintf(stderr, "  markup: \"%s\"\n", markup);
+    abort();
+}
+
+/* Check the vectorized kernels against their scalar references, at every alignment relative to a 16 byte block */
+static void check_kernels(const char *data, size_t size)
+{
+    temaku_options_t html = TEMAKU_DEFAULT_OPTIONS;
+    html.sequence_writer = &temaku_write_html_sequence;
+    for (size_t offset=0; offset < 16 && offset < size; offset++) {
+        temaku_memory_writer_t expected = temaku_memory_writer_new(), actual = temaku_memory_writer_new();
+        size_t valid = temaku_utf8_valid(data + offset, size - offset);
+        size_t expected_valid = temaku_reference_utf8_valid(data + offset, size - offset);
+        if (valid != expected_valid) {
+            fprintf(stderr, "temaku-fuzz: temaku_utf8_valid at offset %zu returned %zu, expected %zu\n", offset, valid, expected_valid);
+            abort();
+        }
+        temaku_reference_html_data(&expected.writer, data + offset, size - offset);
+        temaku_writedata(&html, &actual.writer, data + offset, size - offset);
+        if (actual.size != expected.size || (actual.size && memcmp(actual.base, expected.base, actual.size) != 0)) {
+            fprintf(stderr, "temaku-fuzz: HTML escaping at offset %zu differs from the reference\n", offset);
+            abort();
+        }
+        temaku_memory_writer_free(&expected);
+        temaku_memory_writer_free(&actual);
+    }
+}
+
+/* Draw @{markup} into a fresh screen, twice, returning what the first update wrote */
+static temaku_memory_writer_t draw_screen(const char *markup, size_t size)
+{
+    temaku_memory_writer_t first = temaku_memory_writer_new(), second = temaku_memory_writer_new();
+    temaku_screen_t screen;
+    temaku_screen_init(&screen);
+    temaku_screen_update(&screen, NULL, &first.writer, markup, size);
+    temaku_screen_update(&screen, NULL, &second.writer, markup, size);
+    if (second.size) {
+        fprintf(stderr, "temaku-fuzz: redrawing the same screen wrote %zu bytes\n", second.size);
+        fprintf(stderr, "  markup: \"%s\"\n", markup);
+        abort();
+    }
+    temaku_memory_writer_free(&second);
+    temaku_screen_free(&screen);
+    return first;
+}
+/* A %{ ... %} block takes up no cells on a screen, so it must only add its own bytes in front of what is drawn */
+static void check_screen(const char *markup, size_t size)
+{
+    static const char title[] = "%{\033]0;title\007%}", raw[] = "\033]0;title\007";
+    temaku_memory_writer_t expected, actual, prefixed;
+    /* A terminator right at the end of the input is written as text, so the block needs something after it */
+    if (!size) return;
+    prefixed = temaku_memory_writer_new();
+    temaku_write(&prefixed.writer, title, sizeof(title) - 1);
+    temaku_write(&prefixed.writer, markup, size);
+    expected = draw_screen(markup, size);
+    actual = draw_screen(prefixed.base, prefixed.size);
+    if (actual.size != expected.size + sizeof(raw) - 1 || memcmp(actual.base, raw, sizeof(raw) - 1) != 0 ||
+        (expected.size && memcmp(actual.base + sizeof(raw) - 1, expected.base, expected.size) != 0)) {
+        fprintf(stderr, "temaku-fuzz: a %%{ ... %%} block changed what the screen draws\n");
+        fprintf(stderr, "  markup: \"%s\"\n", markup);
+        abort();
+    }
+    temaku_memory_writer_free(&expected);
+    temaku_memory_writer_free(&actual);
+    temaku_memory_writer_free(&prefixed);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    temaku_param_resolver_t *resolver = engine_resolver();
+    temaku_memory_writer_t expected = temaku_memory_writer_new();
+    temaku_options_t options;
+    unsigned mode;
+    char *markup;
+    size_t len;
+    if (size == 0) return 0;
+    engine_fine_splits = true;
+    check_kernels((const char *)data, size);
+    mode = data[0] % ENGINE_MODES;
+    options = engine_options(mode);
+    /* The reference reads up to the first NUL, so every engine gets the same NUL-terminated copy */
+    if (!(markup = (char *)malloc(size))) return 0;
+    memcpy(markup, data + 1, size - 1);
+    markup[size - 1] = '\0';
+    len = strlen(markup);
+    check_screen(markup, len);
+    engines[0].render(&options, &expected.writer, markup, len, resolver);
+    for (size_t i=1; i < ENGINE_COUNT; i++) {
+        temaku_memory_writer_t actual = temaku_memory_writer_new();
+        engines[i].render(&options, &actual.writer, markup, len, resolver);
+        if (actual.size != expected.size || (actual.size && memcmp(actual.base, expected.base, actual.size) != 0)) {
+            report(engines[i].name, mode, markup, &expected, &actual);
+        }
+        temaku_memory_writer_free(&actual);
+    }
+    temaku_memory_writer_free(&expected);
+    free(markup);
+    return 0;
+}
+
+#if defined(TEMAKU_FUZZ_MAIN)
+static void run_file(FILE *fp)
+{
+    temaku_memory_writer_t input = temaku_memory_writer_new();
+    char buffer[65536];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0) temaku_write(&input.writer, buffer, n);
+    LLVMFuzzerTestOneInput((const uint8_t *)input.base, input.size);
+    temaku_memory_writer_free(&input);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        run_file(stdin);
+        return 0;
+    }
+    for (int i=1; i < argc; i++) {
+        FILE *fp = fopen(argv[i], "rb");
+        if (!fp) {
+            perror(argv[i]);
+            return 1;
+        }
+        run_file(fp);
+        fclose(fp);
+    }
+    return 0;
+}
+#endif
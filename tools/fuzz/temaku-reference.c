@@ -0,0 +1,391 @@
+/*
+ * The reference parser: temaku_markup as it was before any of the faster
+ * paths (bulk text runs, vectorized scanning, streaming, templates) were
+ * added, processing the markup one byte at a time and writing every
+ * character as its own TEMAKU_DATA sequence.
+ *
+ * Do not optimize or refactor this file. It only changes when the markup
+ * semantics change on purpose, and then in the same way as src/temaku.c.
+ * Changes so far:
+ * - ALTERNATIVE_END at the end of input is gated on do_style, BGLINE_END
+ *   at the end of a line on do_color (fan-out).
+ * - %P{name} parameters (compiled templates).
+ * - Characters are UTF-8: multibyte characters are written as one
+ *   TEMAKU_DATA sequence, and match word characters as a whole.
+ *
+ * After the parser are scalar references for the vectorized kernels that
+ * the parser shares with src/temaku.c, and so can't check by itself: HTML
+ * escaping of TEMAKU_DATA and UTF-8 validation.
+ */
+#include "temaku-reference.h"
+
+#include <ctype.h>
+#include <stdint.h>
+#include <string.h>
+
+static inline bool strequaln(const char *a, const char *b, size_t n)
+{
+
+    for (;;) {
+        if (!n) return true;
+        if (!*a && !*b) return true;
+        if (*a != *b) return false;
+        a++, b++, n--;
+    }
+    return true;
+}
+static inline bool strequalni(const char *a, const char *b, size_t n)
+{
+
+    for (;;) {
+        if (!n) return true;
+        if (!*a && !*b) return true;
+        if (tolower(*a) != tolower(*b)) return false;
+        a++, b++, n--;
+    }
+    return true;
+}
+
+/* The length of the UTF-8 character at @{str}, or 0 if it is invalid */
+static size_t utf8_char(const char *str)
+{
+    const unsigned char *s = (const unsigned char *)str;
+    size_t size;
+    if (s[0] < 0x80) return 1;
+    else if (s[0] >= 0xc2 && s[0] <= 0xdf) size = 2;
+    else if (s[0] >= 0xe0 && s[0] <= 0xef) size = 3;
+    else if (s[0] >= 0xf0 && s[0] <= 0xf4) size = 4;
+    else return 0;
+    for (size_t i=1; i < size; i++) {
+        if ((s[i] & 0xc0) != 0x80) return 0;
+    }
+    if (s[0] == 0xe0 && s[1] < 0xa0) return 0;
+    if (s[0] == 0xed && s[1] >= 0xa0) return 0;
+    if (s[0] == 0xf0 && s[1] < 0x90) return 0;
+    if (s[0] == 0xf4 && s[1] >= 0x90) return 0;
+    return size;
+}
+static bool temaku_wordchar(struct temaku_options *options, const char *str)
+{
+    size_t size;
+    if (strchr(options->wordchars, '%') && str[0] == '%') return str[1] == '%';
+    if ((unsigned char)str[0] < 0x80) return strchr(options->wordchars, str[0]);
+    if (!(size = utf8_char(str))) return false;
+    for (const char *p = strchr(options->wordchars, str[0]); p; p = strchr(p + 1, str[0])) {
+        if (strncmp(p, str, size) == 0) return true;
+    }
+    return false;
+}
+
+int temaku_reference_markup(struct temaku_options *options, temaku_writer_t *writer, const char *markup, size_t markuplen, temaku_param_resolver_t *resolver)
+{
+#define TEMAKU_DO_COLOR(block) if (options->do_markup && options->do_color) do { block; } while (0)
+#define TEMAKU_DO_STYLE(block) if (options->do_markup && options->do_style) do { block; } while (0)
+#define TEMAKU_DO_LINKS(block) if (options->do_markup && options->do_links) do { block; } while (0)
+    static const char *color_names[] = {
+        "black",
+        "red",
+        "green",
+        "yellow",
+        "blue",
+        "purple",
+        "cyan",
+        "white",
+        NULL
+    };
+    int row = 0, column = 0;
+    int fgcolor = -1;
+    int bgcolor = -1;
+    const char *s = markup;
+    bool in_word = false;
+    unsigned ctx = 0;
+    struct temaku_string data = { NULL, 0 };
+    if (markuplen == 0 || markuplen == SIZE_MAX) {
+        markuplen = strlen(markup);
+    }
+    if (options == NULL) options = &temaku_default_options;
+    enum {
+        CTX_HEADER      = 0x1,
+        CTX_BOLD        = 0x2,
+        CTX_ITALIC      = 0x4,
+        CTX_UNDERLINE   = 0x8,
+        CTX_ALTERNATIVE = 0x10,
+        CTX_BGLINE      = 0x20,
+    };
+    data.base = markup;
+    data.size = markuplen;
+    temaku_writesequence(options, writer, TEMAKU_START, &data);
+    while (*s) {
+        const char *seq = s;
+        char c = *s;
+        ++s;
+        switch (c) {
+        case '=':
+            if (column != 0) goto put;
+            ctx |= CTX_HEADER;
+            TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_HEADER_START, NULL));
+            break;
+        case '*':
+            if ((ctx & CTX_BOLD) == 0) {
+                if (in_word) goto put;
+                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_BOLD_START, NULL));
+                ctx |= CTX_BOLD;
+            } else if (!temaku_wordchar(options, s)) {
+                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_BOLD_END, NULL));
+                ctx &= ~CTX_BOLD;
+            }
+            break;
+        case '/':
+            if ((ctx & CTX_ITALIC) == 0) {
+                if (in_word) goto put;
+                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_ITALIC_START, NULL));
+                ctx |= CTX_ITALIC;
+            } else if (!temaku_wordchar(options, s)) {
+                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_ITALIC_END, NULL));
+                ctx &= ~CTX_ITALIC;
+            }
+            break;
+        case '_':
+            if ((ctx & CTX_UNDERLINE) == 0) {
+                if (in_word) goto put;
+                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_UNDERLINE_START, NULL));
+                ctx |= CTX_UNDERLINE;
+            } else if (!temaku_wordchar(options, s)) {
+                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_UNDERLINE_END, NULL));
+                ctx &= ~CTX_UNDERLINE;
+            }
+            break;
+        case '|':
+            if ((ctx & CTX_ALTERNATIVE) == 0) {
+                if (in_word) goto put;
+                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_ALTERNATIVE_START, NULL));
+                ctx |= CTX_ALTERNATIVE;
+            } else if (!temaku_wordchar(options, s)) {
+                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_ALTERNATIVE_END, NULL));
+                ctx &= ~CTX_ALTERNATIVE;
+            }
+            break;
+        case '\n':
+            data.base = &c;
+            data.size = 1;
+            temaku_writesequence(options, writer, TEMAKU_DATA, &data);
+            if (ctx & CTX_HEADER)
+                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_HEADER_END, NULL));
+            if (ctx & CTX_BOLD)
+                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_BOLD_END, NULL));
+            if (ctx & CTX_ITALIC)
+                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_ITALIC_END, NULL));
+            if (ctx & CTX_UNDERLINE)
+                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_UNDERLINE_END, NULL));
+            if (ctx & CTX_ALTERNATIVE)
+                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_ALTERNATIVE_END, NULL));
+            if (ctx & CTX_BGLINE)
+                TEMAKU_DO_COLOR(temaku_writesequence(options, writer, TEMAKU_BGLINE_END, NULL));
+            ctx = 0;
+            ++row;
+            column = 0;
+            in_word = false;
+            break;
+        case '%':
+            c = *s;
+            s += !!*s;
+            switch (c) {
+            case '\0': break;
+            case '{':
+                {
+                    const char *start = s;
+                    while (*s && (s[-1] != '}' || s[-2] != '%')) ++s;
+                    int size = s - start - (*s?2:0);
+                    temaku_write(writer, start, size);
+                }
+                break;
+            case 'F':
+            case 'K':
+                if (*s != '{') break;
+                ++s;
+                const char *start = s;
+                while (*s && *s != '}') ++s;
+                int size = s - start;
+                TEMAKU_DO_COLOR({
+                    if (strequalni("reset", start, size)) {
+                        if (c == 'F') {
+                            TEMAKU_DO_COLOR(temaku_writesequence(options, writer, TEMAKU_FGCOLOR_END, &fgcolor));
+                            fgcolor = -1;
+                        } else {
+                            TEMAKU_DO_COLOR(temaku_writesequence(options, writer, TEMAKU_BGCOLOR_END, &bgcolor));
+                            bgcolor = -1;
+                        }
+                    } else for (int j=0; color_names[j]; j++) {
+                        if (strequaln(color_names[j], start, size)) {
+                            if (c == 'F') {
+                                fgcolor = j;
+                                TEMAKU_DO_COLOR(temaku_writesequence(options, writer, TEMAKU_FGCOLOR_START, &fgcolor));
+                            } else {
+                                bgcolor = j;
+                                TEMAKU_DO_COLOR(temaku_writesequence(options, writer, TEMAKU_BGCOLOR_START, &fgcolor));
+                            }
+                            break;
+                        } else if (strequalni(color_names[j], start, size)) {
+                            /* Color name contains at least one uppercase letter */
+                            if (c == 'F') {
+                                fgcolor = j + 8; /* Use bright colors */
+                                TEMAKU_DO_COLOR(temaku_writesequence(options, writer, TEMAKU_FGCOLOR_START, &fgcolor));
+                            } else {
+                                bgcolor = j + 8; /* Use bright colors */
+                                TEMAKU_DO_COLOR(temaku_writesequence(options, writer, TEMAKU_BGCOLOR_START, &fgcolor));
+                            }
+                            break;
+                        }
+                    }
+                });
+                s += !!*s;
+                break;
+            case 'f':
+                TEMAKU_DO_COLOR(temaku_writesequence(options, writer, TEMAKU_FGCOLOR_END, &fgcolor));
+                fgcolor = -1;
+                break;
+            case 'k':
+                TEMAKU_DO_COLOR(temaku_writesequence(options, writer, TEMAKU_BGCOLOR_END, &bgcolor));
+                bgcolor = -1;
+                break;
+            case 'L':
+                if (*s != '{') break;
+                ++s;
+                data.base = s;
+                while (*s && *s != '}') ++s;
+                data.size = s - data.base;
+                TEMAKU_DO_LINKS(temaku_writesequence(options, writer, TEMAKU_LINK_START, &data));
+                s += !!*s;
+                break;
+            case 'P':
+                if (*s != '{') break;
+                ++s;
+                data.base = s;
+                while (*s && *s != '}') ++s;
+                data.size = s - data.base;
+                if (resolver) (*resolver)((TEMAKU_SELF *)resolver, options, writer, data.base, data.size);
+                s += !!*s;
+                break;
+            case 'l':
+                TEMAKU_DO_LINKS(temaku_writesequence(options, writer, TEMAKU_LINK_END, NULL));
+                break;
+            case 'B':
+                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_BOLD_START, NULL));
+                break;
+            case 'b':
+                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_BOLD_END, NULL));
+                break;
+            case 'I':
+                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_ITALIC_START, NULL));
+                break;
+            case 'i':
+                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_ITALIC_END, NULL));
+                break;
+            case 'U':
+                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_UNDERLINE_START, NULL));
+                break;
+            case 'u':
+                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_UNDERLINE_END, NULL));
+                break;
+            case 'S':
+                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_STRIKETHROUGH_START, NULL));
+                break;
+            case 's':
+                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_STRIKETHROUGH_END, NULL));
+                break;
+            case 'R':
+                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_REVERSE_VIDEO_START, NULL));
+                break;
+            case 'r':
+                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_REVERSE_VIDEO_END, NULL));
+                break;
+            case 'A':
+                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_ALTERNATIVE_START, NULL));
+                break;
+            case 'a':
+                TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_ALTERNATIVE_END, NULL));
+                break;
+            case 'E':
+                TEMAKU_DO_COLOR(temaku_writesequence(options, writer, TEMAKU_BGLINE_START, &bgcolor));
+                ctx |= CTX_BGLINE;
+                break;
+            default:
+                in_word = temaku_wordchar(options, seq);
+                data.base = s - 1;
+                data.size = utf8_char(s - 1) ? utf8_char(s - 1) : 1;
+                s += data.size - 1;
+                temaku_writesequence(options, writer, TEMAKU_DATA, &data);
+                ++column;
+                break;
+            }
+            break;
+default:
+put:
+            in_word = temaku_wordchar(options, seq);
+            data.base = seq;
+            data.size = utf8_char(seq) ? utf8_char(seq) : 1;
+            s = seq + data.size;
+            temaku_writesequence(options, writer, TEMAKU_DATA, &data);
+            ++column;
+            break;
+        }
+    }
+    if (ctx & CTX_HEADER)
+        TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_HEADER_END, NULL));
+    if (ctx & CTX_BOLD)
+        TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_BOLD_END, NULL));
+    if (ctx & CTX_ITALIC)
+        TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_ITALIC_END, NULL));
+    if (ctx & CTX_UNDERLINE)
+        TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_UNDERLINE_END, NULL));
+    if (ctx & CTX_ALTERNATIVE)
+        TEMAKU_DO_STYLE(temaku_writesequence(options, writer, TEMAKU_ALTERNATIVE_END, NULL));
+    if (ctx & CTX_BGLINE)
+        TEMAKU_DO_COLOR(temaku_writesequence(options, writer, TEMAKU_BGLINE_END, NULL));
+    data.base = markup;
+    data.size = markuplen;
+    temaku_writesequence(options, writer, TEMAKU_END, &data);
+    return 0;
+#undef TEMAKU_DO_LINKS
+#undef TEMAKU_DO_STYLE
+#undef TEMAKU_DO_COLOR
+}
+
+int temaku_reference_html_data(temaku_writer_t *writer, const char *data, size_t size)
+{
+    int nwritten = 0;
+    for (size_t i=0; i < size; i++) {
+        switch (data[i]) {
+        case '<': nwritten += temaku_writestr(writer, "&lt;"); break;
+        case '>': nwritten += temaku_writestr(writer, "&gt;"); break;
+        case '&': nwritten += temaku_writestr(writer, "&amp;"); break;
+        default: nwritten += temaku_write(writer, data + i, 1); break;
+        }
+    }
+    return nwritten;
+}
+size_t temaku_reference_utf8_valid(const char *data, size_t size)
+{
+    const unsigned char *s = (const unsigned char *)data;
+    size_t i = 0;
+    while (i < size) {
+        uint32_t cp;
+        size_t n, k;
+        if (s[i] < 0x80) {
+            i++;
+            continue;
+        }
+        if ((s[i] & 0xe0) == 0xc0) cp = s[i] & 0x1f, n = 2;
+        else if ((s[i] & 0xf0) == 0xe0) cp = s[i] & 0x0f, n = 3;
+        else if ((s[i] & 0xf8) == 0xf0) cp = s[i] & 0x07, n = 4;
+        else break;
+        if (size - i < n) break;
+        for (k=1; k < n && (s[i + k] & 0xc0) == 0x80; k++) cp = cp << 6 | (s[i + k] & 0x3f);
+        if (k < n) break;
+        /* Overlong encodings, surrogates and code points past U+10FFFF */
+        if (cp < (n == 2 ? 0x80u : n == 3 ? 0x800u : 0x10000u)) break;
+        if ((cp >= 0xd800 && cp <= 0xdfff) || cp > 0x10ffff) break;
+        i += n;
+    }
+    return i;
+}
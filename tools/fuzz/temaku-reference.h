@@ -0,0 +1,26 @@
+#ifndef TEMAKU_REFERENCE_H
+#define TEMAKU_REFERENCE_H
+
+#include <temaku.h>
+
+/**
+ * Write the marked-up result of @{markup} to @{writer}, using the frozen
+ * byte-at-a-time parser. Every faster way of rendering markup must write
+ * exactly the same bytes as this function.
+ *
+ * Like the original temaku_markup, it reads up to the first NUL character
+ * no matter what @{markuplen} says, so @{markup} must be NUL-terminated.
+ *
+ * @{resolver}      The parameter resolver, or ``NULL`` to leave ``%P{name}`` parameters out.
+ */
+int temaku_reference_markup(temaku_options_t *options, temaku_writer_t *writer, const char *markup, size_t markuplen, temaku_param_resolver_t *resolver);
+/**
+ * Write @{data} to @{writer} escaped like the HTML writer's TEMAKU_DATA, one byte at a time.
+ */
+int temaku_reference_html_data(temaku_writer_t *writer, const char *data, size_t size);
+/**
+ * Return what :func:`temaku_utf8_valid` returns, by decoding one character at a time.
+ */
+size_t temaku_reference_utf8_valid(const char *data, size_t size);
+
+#endif /* TEMAKU_REFERENCE_H */
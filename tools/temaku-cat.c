@@ -0,0 +1,184 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <temaku.h>
+#include <temaku_libc.h>
+
+#define CHUNK_SIZE (1 << 20)
+
+const char usage[] =
+"=USAGE\n"
+"  _temaku-cat_ |[options]|          Render temaku markup from stdin to stdout\n"
+"  _temaku-cat_ |--ansi| |[options]|   Re-render ANSI colored text from stdin, e.g. as HTML\n"
+"=OPTIONS\n"
+"  |--no-color|                  Do not output colors\n"
+"  |--no-style|                  Do not output text styles (e.g. /italic/)\n"
+"  |--no-links|                  Do not output hyperlinks\n"
+"  |--strip|                     Do not output any markup at all\n"
+"  |--html|                      Output HTML instead of ANSI escape sequences\n"
+"  |--ansi|                      Read ANSI colored text instead of temaku markup\n"
+"  |--stats|                     Print throughput statistics to stderr\n"
+"  |--help|                      You're looking at it!\n"
+;
+
+typedef struct fd_writer fd_writer_t;
+
+/* Buffered writer around a file descriptor, so that small sequences don't each cost a syscall */
+struct fd_writer {
+    temaku_writer_t writer;
+    int fd;
+    size_t size;
+    size_t total;
+    bool failed;
+    char buffer[CHUNK_SIZE];
+};
+
+static bool write_all(int fd, const char *data, size_t size)
+{
+    while (size) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+static void fd_writer_flush(fd_writer_t *writer)
+{
+    if (!writer->failed && !write_all(writer->fd, writer->buffer, writer->size)) writer->failed = true;
+    writer->size = 0;
+}
+static int fd_writer_cb(TEMAKU_SELF *self, const void *data, size_t size)
+{
+    fd_writer_t *writer = (fd_writer_t *)self;
+    writer->total += size;
+    if (size > sizeof(writer->buffer) - writer->size) {
+        fd_writer_flush(writer);
+        /* Large writes bypass the buffer entirely */
+        if (size >= sizeof(writer->buffer)) {
+            if (!writer->failed && !write_all(writer->fd, data, size)) writer->failed = true;
+            return size;
+        }
+    }
+    memcpy(writer->buffer + writer->size, data, size);
+    writer->size += size;
+    return size;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* temaku_stream_write stops at a NUL, so write those as plain text and carry on after them */
+static void stream_write_all(temaku_stream_t *stream, const char *data, size_t size)
+{
+    const char *end = data + size;
+    while (data < end) {
+        const char *nul = (const char *)memchr(data, '\0', end - data);
+        if (!nul) nul = end;
+        if (nul > data) temaku_stream_write(stream, data, nul - data);
+        if (nul == end) break;
+        temaku_stream_writedata(stream, "", 1);
+        data = nul + 1;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    static fd_writer_t out;
+    static char in[CHUNK_SIZE];
+    temaku_options_t options = TEMAKU_DEFAULT_OPTIONS;
+    temaku_stream_t stream;
+    static temaku_ansi_decoder_t decoder;
+    bool ansi = false;
+    bool stats = false;
+    size_t pending = 0;
+    size_t total = 0;
+    double start;
+    for (int i=1; i < argc; i++) {
+        if (strcmp(argv[i], "--no-color") == 0) {
+            options.do_color = false;
+        } else if (strcmp(argv[i], "--no-style") == 0) {
+            options.do_style = false;
+        } else if (strcmp(argv[i], "--no-links") == 0) {
+            options.do_links = false;
+        } else if (strcmp(argv[i], "--strip") == 0) {
+            options.do_markup = false;
+        } else if (strcmp(argv[i], "--html") == 0) {
+            options.sequence_writer = &temaku_write_html_sequence;
+        } else if (strcmp(argv[i], "--ansi") == 0) {
+            ansi = true;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            stats = true;
+        } else if (strcmp(argv[i], "--help") == 0) {
+            temaku_markup(NULL, &temaku_stdout_writer, usage, 0);
+            return 0;
+        } else {
+            fprintf(stderr, "temaku-cat: unknown option '%s'\n", argv[i]);
+            temaku_markup(NULL, &temaku_stderr_writer, usage, 0);
+            return 2;
+        }
+    }
+    out.writer = fd_writer_cb;
+    out.fd = STDOUT_FILENO;
+    start = now();
+    if (ansi) temaku_ansi_begin(&decoder, &options, &out.writer);
+    else temaku_stream_begin(&stream, &options, &out.writer);
+    for (;;) {
+        ssize_t n = read(STDIN_FILENO, in + pending, sizeof(in) - pending);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("temaku-cat: read");
+            return 1;
+        }
+        if (n == 0) break;
+        total += n;
+        if (ansi) {
+            /* The decoder can handle escape sequences split between chunks */
+            temaku_ansi_write(&decoder, in, n);
+            continue;
+        }
+        pending += n;
+        /* Only feed complete lines, so that no sequence is split between chunks */
+        size_t size = pending;
+        while (size && in[size - 1] != '\n') --size;
+        /* A line longer than the buffer has to be split anyway, but not in the middle of a UTF-8 character */
+        if (size == 0 && pending == sizeof(in)) {
+            size = pending;
+            while (size > pending - 3 && ((unsigned char)in[size - 1] & 0xc0) == 0x80) --size;
+            if ((unsigned char)in[size - 1] >= 0xc0) --size;
+        }
+        stream_write_all(&stream, in, size);
+        memmove(in, in + size, pending - size);
+        pending -= size;
+    }
+    if (ansi) {
+        temaku_ansi_end(&decoder);
+    } else {
+        stream_write_all(&stream, in, pending);
+        temaku_stream_end(&stream);
+    }
+    fd_writer_flush(&out);
+    if (out.failed) {
+        perror("temaku-cat: write");
+        return 1;
+    }
+    if (stats) {
+        double elapsed = now() - start;
+        fprintf(stderr, "temaku-cat: read %zu bytes, wrote %zu bytes in %.3fs (%.1f MB/s)\n",
+                total, out.total, elapsed, elapsed > 0 ? total / elapsed / 1e6 : 0.0);
+    }
+    return 0;
+}
@@ -0,0 +1,284 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <temaku.h>
+#include <temaku_libc.h>
+
+#define MAX_VARIANTS 16
+
+const char usage[] =
+"=USAGE\n"
+"  _temaku-embed_ |[options]| |<file.tmk>...|\n"
+"\n"
+"  Pre-renders temaku markup files into C arrays, one for each variant.\n"
+"  Writes _<output>.h_ and _<output>.c_, which do not depend on temaku.\n"
+"=OPTIONS\n"
+"  |-o <output>|                 Output file names, without extension (default: |tmk|)\n"
+"  |-p <prefix>|                 Prefix for all generated symbols (default: |tmk_|)\n"
+"  |-v <name>=<flags>|           Add a variant, |<flags>| is a comma separated list of:\n"
+"                                |ansi|, |html|, |strip|, |no-color|, |no-style|, |no-links|\n"
+"                                (default: |-v ansi=ansi,no-links -v plain=strip|)\n"
+"  |--help|                      You're looking at it!\n"
+;
+
+typedef struct variant variant_t;
+
+struct variant {
+    char *name;
+    temaku_options_t options;
+    unsigned features;
+};
+
+enum {
+    FEATURE_COLOR = 0x1,
+    FEATURE_STYLE = 0x2,
+    FEATURE_LINKS = 0x4,
+    FEATURE_HTML  = 0x8,
+};
+
+static void die(const char *msg, const char *arg)
+{
+    fprintf(stderr, "temaku-embed: %s '%s'\n", msg, arg);
+    exit(1);
+}
+static char *read_file(const char *path, size_t *size)
+{
+    temaku_memory_writer_t writer = temaku_memory_writer_new();
+    char buffer[65536];
+    size_t n;
+    FILE *fp = fopen(path, "rb");
+    if (!fp) die("cannot open", path);
+    while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+        if (temaku_write(&writer.writer, buffer, n) < 0) die("out of memory reading", path);
+    }
+    fclose(fp);
+    return temaku_memory_writer_release(&writer, size);
+}
+/* Turn @{str} into a valid C identifier in place */
+static char *identifier(char *str)
+{
+    for (char *s = str; *s; s++) {
+        if (!isalnum((unsigned char)*s)) *s = '_';
+    }
+    return str;
+}
+static char *upper(const char *str)
+{
+    static char buffer[256];
+    size_t i;
+    for (i=0; str[i] && i < sizeof(buffer) - 1; i++) buffer[i] = toupper((unsigned char)str[i]);
+    buffer[i] = '\0';
+    return buffer;
+}
+/* The name of the symbol for file @{path}, i.e. its base name without extension */
+static char *symbol_name(const char *path)
+{
+    const char *base = strrchr(path, '/');
+    char *name, *dot;
+    base = base ? base + 1 : path;
+    name = malloc(strlen(base) + 2);
+    if (!name) die("out of memory for", path);
+    /* Identifiers can't start with a digit */
+    sprintf(name, "%s%s", isdigit((unsigned char)base[0]) ? "_" : "", base);
+    if ((dot = strrchr(name, '.')) && dot != name) *dot = '\0';
+    return identifier(name);
+}
+static void parse_variant(variant_t *variant, const char *spec)
+{
+    temaku_options_t options = TEMAKU_DEFAULT_OPTIONS;
+    const char *eq = strchr(spec, '=');
+    const char *flags;
+    if (!eq || eq == spec) die("invalid variant", spec);
+    variant->name = strndup(spec, eq - spec);
+    identifier(variant->name);
+    for (flags = eq + 1; *flags; ) {
+        size_t len = strcspn(flags, ",");
+        if (len == 4 && strncmp(flags, "ansi", len) == 0) {
+            options.sequence_writer = &temaku_write_ansi_sequence;
+        } else if (len == 4 && strncmp(flags, "html", len) == 0) {
+            options.sequence_writer = &temaku_write_html_sequence;
+        } else if (len == 5 && strncmp(flags, "strip", len) == 0) {
+            options.do_markup = false;
+        } else if (len == 8 && strncmp(flags, "no-color", len) == 0) {
+            options.do_color = false;
+        } else if (len == 8 && strncmp(flags, "no-style", len) == 0) {
+            options.do_style = false;
+        } else if (len == 8 && strncmp(flags, "no-links", len) == 0) {
+            options.do_links = false;
+        } else if (len != 0) {
+            die("invalid variant flags", spec);
+        }
+        flags += len + !!flags[len];
+    }
+    variant->options = options;
+    variant->features = 0;
+    if (options.sequence_writer == &temaku_write_html_sequence) variant->features |= FEATURE_HTML;
+    if (options.do_markup && options.do_color) variant->features |= FEATURE_COLOR;
+    if (options.do_markup && options.do_style) variant->features |= FEATURE_STYLE;
+    if (options.do_markup && options.do_links) variant->features |= FEATURE_LINKS;
+}
+/* Write @{size} bytes of @{data} as a C string literal, one line of output per line of data */
+static void write_literal(FILE *fp, const char *data, size_t size)
+{
+    fputs("    \"", fp);
+    for (size_t i=0; i < size; i++) {
+        unsigned char c = data[i];
+        if (c == '\n') {
+            fputs(i + 1 < size ? "\\n\"\n    \"" : "\\n", fp);
+        } else if (c == '"' || c == '\\') {
+            fprintf(fp, "\\%c", c);
+        } else if (c == '?') {
+            /* Avoid trigraphs */
+            fputs("\\?", fp);
+        } else if (c < 0x20 || c >= 0x7f) {
+            /* Always use three octal digits, so the next character can't become part of the escape */
+            fprintf(fp, "\\%03o", c);
+        } else {
+            fputc(c, fp);
+        }
+    }
+    fputs("\"", fp);
+}
+
+int main(int argc, char **argv)
+{
+    variant_t variants[MAX_VARIANTS];
+    size_t nvariants = 0;
+    const char *output = "tmk";
+    const char *prefix = "tmk_";
+    const char **files;
+    size_t nfiles = 0;
+    size_t *sizes;
+    char path[4096];
+    FILE *h, *c;
+    files = malloc(argc * sizeof(*files));
+    if (!files) die("out of memory for", "arguments");
+    for (int i=1; i < argc; i++) {
+        if (strcmp(argv[i], "--help") == 0) {
+            temaku_options_t options = temaku_detect_options(1);
+            temaku_markup(&options, &temaku_stdout_writer, usage, 0);
+            return 0;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            prefix = argv[++i];
+        } else if (strcmp(argv[i], "-v") == 0 && i + 1 < argc) {
+            if (nvariants == MAX_VARIANTS) die("too many variants at", argv[i + 1]);
+            parse_variant(&variants[nvariants++], argv[++i]);
+        } else if (argv[i][0] == '-') {
+            die("unknown option", argv[i]);
+        } else {
+            files[nfiles++] = argv[i];
+        }
+    }
+    if (nfiles == 0) {
+        temaku_markup(NULL, &temaku_stderr_writer, usage, 0);
+        return 2;
+    }
+    if (nvariants == 0) {
+        /* No links, so that tmk_select(TMK_COLOR | TMK_STYLE) picks it for a plain terminal */
+        parse_variant(&variants[nvariants++], "ansi=ansi,no-links");
+        parse_variant(&variants[nvariants++], "plain=strip");
+    }
+
+    sizes = malloc(nfiles * nvariants * sizeof(*sizes));
+    if (!sizes) die("out of memory for", "sizes");
+
+    snprintf(path, sizeof(path), "%s.h", output);
+    if (!(h = fopen(path, "w"))) die("cannot open", path);
+    snprintf(path, sizeof(path), "%s.c", output);
+    if (!(c = fopen(path, "w"))) die("cannot open", path);
+
+    fprintf(h, "/* Generated by temaku-embed, do not edit */\n");
+    fprintf(h, "#ifndef %sH\n#define %sH\n\n#include <stddef.h>\n\n", upper(prefix), upper(prefix));
+    fprintf(h, "enum %sid {\n", prefix);
+    for (size_t i=0; i < nfiles; i++) {
+        fprintf(h, "    %s", upper(prefix));
+        fprintf(h, "%s,\n", upper(symbol_name(files[i])));
+    }
+    fprintf(h, "    %sCOUNT\n};\n", upper(prefix));
+    fprintf(h, "enum %svariant {\n", prefix);
+    for (size_t i=0; i < nvariants; i++) {
+        fprintf(h, "    %sVARIANT_", upper(prefix));
+        fprintf(h, "%s,\n", upper(variants[i].name));
+    }
+    fprintf(h, "    %sVARIANT_COUNT\n};\n", upper(prefix));
+    fprintf(h, "/* Features for %sselect */\n", prefix);
+    fprintf(h, "#define %sCOLOR 0x%x\n", upper(prefix), FEATURE_COLOR);
+    fprintf(h, "#define %sSTYLE 0x%x\n", upper(prefix), FEATURE_STYLE);
+    fprintf(h, "#define %sLINKS 0x%x\n", upper(prefix), FEATURE_LINKS);
+    fprintf(h, "#define %sHTML 0x%x\n\n", upper(prefix), FEATURE_HTML);
+    fprintf(h, "/* Return the pre-rendered text of @{id} in @{variant}, and store its length in @{size} */\n");
+    fprintf(h, "extern const char *%sget(enum %sid id, enum %svariant variant, size_t *size);\n", prefix, prefix, prefix);
+    fprintf(h, "/*\n");
+    fprintf(h, " * Return the variant that uses the fewest features not in @{features} (ideally none),\n");
+    fprintf(h, " * and of those the one with the most of @{features}\n");
+    fprintf(h, " */\n");
+    fprintf(h, "extern enum %svariant %sselect(unsigned features);\n", prefix, prefix);
+    fprintf(h, "\n#endif\n");
+
+    fprintf(c, "/* Generated by temaku-embed, do not edit */\n");
+    {
+        const char *base = strrchr(output, '/');
+        fprintf(c, "#include \"%s.h\"\n\n", base ? base + 1 : output);
+    }
+    fprintf(c, "static const char *const %stext[%sCOUNT][%sVARIANT_COUNT] = {\n", prefix, upper(prefix), upper(prefix));
+    for (size_t i=0; i < nfiles; i++) {
+        size_t size;
+        char *markup = read_file(files[i], &size);
+        fprintf(c, "    { /* %s */\n", files[i]);
+        for (size_t j=0; j < nvariants; j++) {
+            temaku_memory_writer_t writer = temaku_memory_writer_new();
+            char *text;
+            size_t textsize;
+            temaku_markup(&variants[j].options, &writer.writer, markup, size);
+            if (!(text = temaku_memory_writer_release(&writer, &textsize))) die("out of memory rendering", files[i]);
+            sizes[i * nvariants + j] = textsize;
+            fprintf(c, "    /* %s, %zu bytes */\n", variants[j].name, textsize);
+            write_literal(c, text, textsize);
+            fprintf(c, ",\n");
+            free(text);
+        }
+        fprintf(c, "    },\n");
+        free(markup);
+    }
+    fprintf(c, "};\n");
+    fprintf(c, "static const size_t %ssize[%sCOUNT][%sVARIANT_COUNT] = {\n", prefix, upper(prefix), upper(prefix));
+    for (size_t i=0; i < nfiles; i++) {
+        fprintf(c, "    {");
+        for (size_t j=0; j < nvariants; j++) fprintf(c, " %zu,", sizes[i * nvariants + j]);
+        fprintf(c, " },\n");
+    }
+    fprintf(c, "};\n");
+    fprintf(c, "static const unsigned %sfeatures[%sVARIANT_COUNT] = {", prefix, upper(prefix));
+    for (size_t j=0; j < nvariants; j++) fprintf(c, " 0x%x,", variants[j].features);
+    fprintf(c, " };\n\n");
+    fprintf(c,
+        "const char *%sget(enum %sid id, enum %svariant variant, size_t *size)\n"
+        "{\n"
+        "    if (size) *size = %ssize[id][variant];\n"
+        "    return %stext[id][variant];\n"
+        "}\n", prefix, prefix, prefix, prefix, prefix);
+    fprintf(c,
+        "enum %svariant %sselect(unsigned features)\n"
+        "{\n"
+        "    int best = 0, best_extra = 0, best_count = -1;\n"
+        "    for (int i=0; i < %sVARIANT_COUNT; i++) {\n"
+        "        unsigned match = %sfeatures[i] & features, extra = %sfeatures[i] & ~features;\n"
+        "        int count = 0, extra_count = 0;\n"
+        "        while (match) count += match & 1, match >>= 1;\n"
+        "        while (extra) extra_count += extra & 1, extra >>= 1;\n"
+        "        if (best_count < 0 || extra_count < best_extra || (extra_count == best_extra && count > best_count)) {\n"
+        "            best = i, best_extra = extra_count, best_count = count;\n"
+        "        }\n"
+        "    }\n"
+        "    return (enum %svariant)best;\n"
+        "}\n", prefix, prefix, upper(prefix), prefix, prefix, prefix);
+    fclose(h);
+    fclose(c);
+    return 0;
+}